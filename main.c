@@ -8,6 +8,15 @@ int main(void)
     InitWindow(screenWidth, screenHeight, "UI Test");
     UIBuilder *builder = UIBuilderAlloc(1024);
 
+    UIPanelStyle overlayStyle = {
+        .alignH = CENTER,
+        .alignV = MIDDLE,
+        .background = BLACK,
+        .borderThickness = 2,
+        .borderColor = RED,
+        .padding = 12,
+    };
+
     SetTargetFPS(60);
 
     while (!WindowShouldClose())
@@ -46,10 +55,7 @@ int main(void)
         UIDraw(builder, (Vector2){0, 0});
 
         UIInitEx(builder, screenWidth, screenHeight);
-        UIAlign(builder, CENTER, MIDDLE);
-        UIBackground(builder, BLACK);
-        UIBorder(builder, 2, RED);
-        UIPadding(builder, 12);
+        UIPanel(builder, overlayStyle);
         UIText(builder, "Overlay", 20, RED);
         UIDraw(builder, (Vector2){0, 0});
 
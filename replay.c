@@ -0,0 +1,110 @@
+#include "ui.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+// Replays a capture file made with UICaptureBegin through layout and the
+// CPU rasterizer, and reports how long each pass took.
+static void usage(const char *name)
+{
+    printf("usage: %s <capture file> [-size width height] [-font file size] [-out last frame.png]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int width = 800;
+    int height = 450;
+    const char *output = NULL;
+    bool hasFont = false;
+
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-size") == 0 && i + 2 < argc)
+        {
+            width = atoi(argv[++i]);
+            height = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-font") == 0 && i + 2 < argc)
+        {
+            const char *fontFile = argv[++i];
+            if (!UILoadFont(fontFile, atoi(argv[++i])))
+                return 1;
+            hasFont = true;
+        }
+        else if (strcmp(argv[i], "-out") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0)
+    {
+        printf("width and height must be positive\n");
+        return 1;
+    }
+
+    UIReplay *replay = UIReplayOpen(argv[1]);
+    if (replay == NULL)
+        return 1;
+
+    UIBuilder *builder = UIBuilderAlloc(1 << 20);
+    Image image = GenImageColor(width, height, BLACK);
+
+    int frames = 0;
+    double layoutSeconds = 0;
+    double rasterSeconds = 0;
+
+    int result = 0;
+    while (UIReplayNextFrame(replay, builder))
+    {
+        // Without a window text can only be measured with a loaded font.
+        if (UIReplayFrameHasText(replay) && !hasFont)
+        {
+            printf("frame %d has text, replay it with -font\n", frames);
+            result = 1;
+            break;
+        }
+
+        ImageClearBackground(&image, BLACK);
+
+        clock_t start = clock();
+        UILayout(builder, (Vector2){0, 0});
+        clock_t laidOut = clock();
+        UIRasterizeTile(builder, &image, (Rectangle){0, 0, width, height});
+        clock_t end = clock();
+
+        layoutSeconds += (double)(laidOut - start) / CLOCKS_PER_SEC;
+        rasterSeconds += (double)(end - laidOut) / CLOCKS_PER_SEC;
+        frames++;
+    }
+
+    printf("frames: %d\n", frames);
+    if (frames > 0)
+    {
+        printf("layout: %.1f us/frame\n", layoutSeconds * 1e6 / frames);
+        printf("raster: %.1f us/frame", rasterSeconds * 1e6 / frames);
+        if (rasterSeconds > 0)
+            printf(", %.1f MP/s", (double)width * height * frames / rasterSeconds / 1e6);
+        printf("\n");
+    }
+
+    if (output != NULL)
+        ExportImage(image, output);
+
+    UnloadImage(image);
+    UIBuilderFree(builder);
+    UIReplayClose(replay);
+    UIUnloadFont();
+
+    return result;
+}
@@ -1,4 +1,15 @@
 #include "ui.h"
+#include "math.h"
+#include "stdio.h"
+#include "string.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UI_SSE2
+#include "emmintrin.h"
+#elif defined(__ARM_NEON)
+#define UI_NEON
+#include "arm_neon.h"
+#endif
 
 #pragma region Types
 typedef enum TokenType
@@ -9,6 +20,9 @@ typedef enum TokenType
     // Primitives
     TOKEN_RECT,
     TOKEN_TEXT,
+    TOKEN_IMAGE,
+    TOKEN_INSTANCE,
+    TOKEN_TEXT_INPUT,
 
     // Containers
     TOKEN_ROW,
@@ -25,7 +39,10 @@ typedef enum TokenType
     TOKEN_SHIM,
     TOKEN_SHIM_H,
     TOKEN_SHIM_V,
-    TOKEN_BACKROUND
+    TOKEN_BACKROUND,
+    TOKEN_PANEL,
+    TOKEN_TRANSFORM,
+    TOKEN_PROTOTYPE
 } TokenType;
 
 typedef struct RectToken
@@ -42,6 +59,30 @@ typedef struct TextToken
     Color color;
 } TextToken;
 
+typedef struct ImageToken
+{
+    UIAtlasImage image;
+    float width;
+    float height;
+    Color tint;
+} ImageToken;
+
+typedef struct InstanceToken
+{
+    int id;
+    // Index of the prototype's token, or 0 if there's no such prototype.
+    size_t prototype;
+    UIInstanceOverrides overrides;
+} InstanceToken;
+
+typedef struct TextInputToken
+{
+    UITextBuffer *buffer;
+    float width;
+    float height;
+    Color color;
+} TextInputToken;
+
 typedef struct RowToken
 {
     float spacing;
@@ -84,6 +125,23 @@ typedef struct BackgroundToken
     Color color;
 } BackgroundToken;
 
+typedef struct PanelToken
+{
+    UIPanelStyle style;
+} PanelToken;
+
+typedef struct TransformToken
+{
+    Vector2 offset;
+    float scale;
+    float alpha;
+} TransformToken;
+
+typedef struct PrototypeToken
+{
+    int id;
+} PrototypeToken;
+
 typedef struct Token
 {
     TokenType type;
@@ -91,6 +149,9 @@ typedef struct Token
     {
         RectToken rect;
         TextToken text;
+        ImageToken image;
+        InstanceToken instance;
+        TextInputToken textInput;
         RowToken row;
         ColumnToken column;
         AlignHToken alignH;
@@ -99,12 +160,59 @@ typedef struct Token
         PaddingToken padding;
         BorderToken border;
         BackgroundToken background;
+        PanelToken panel;
+        TransformToken transform;
+        PrototypeToken prototype;
     };
     float width;
     float height;
     Vector2 position;
+    // Index of the last token in this element, set during sizing.
+    size_t last;
 } Token;
 
+// Where drawTokens sends its output. Positions are scaled then moved by
+// offset, and colors are faded by alpha. Overrides are set while drawing
+// an instance of a prototype. A NULL image draws through raylib, otherwise
+// elements are rasterized into the image within the clip bounds.
+typedef struct DrawTarget
+{
+    Vector2 offset;
+    float scale;
+    float alpha;
+    UIInstanceOverrides *overrides;
+    Image *image;
+    int clipX0;
+    int clipY0;
+    int clipX1;
+    int clipY1;
+} DrawTarget;
+
+typedef enum LayoutPhase
+{
+    LAYOUT_SIZES,
+    LAYOUT_POSITIONS,
+    LAYOUT_DONE
+} LayoutPhase;
+
+// The results of layout for one token, kept so that a frame with the same
+// content can skip layout.
+typedef struct TokenLayout
+{
+    float width;
+    float height;
+    Vector2 position;
+    size_t last;
+} TokenLayout;
+
+#define MAX_PROTOTYPES 64
+
+typedef struct PrototypeEntry
+{
+    int id;
+    size_t token;
+} PrototypeEntry;
+
 typedef struct UIBuilder
 {
     size_t maxTokens;
@@ -112,7 +220,104 @@ typedef struct UIBuilder
     Token *tokenList;
     Token **contextStack;
     size_t stackIndex;
+
+    PrototypeEntry prototypes[MAX_PROTOTYPES];
+    int numPrototypes;
+
+    // Time-sliced layout
+    LayoutPhase layoutPhase;
+    size_t layoutIndex;
+
+    // Cached layout
+    TokenLayout *layoutCache;
+    size_t layoutCacheSize;
+    unsigned long long layoutHash;
+
+    // Capture
+    FILE *captureFile;
+    unsigned char *captureBuffer;
+    size_t captureSize;
+    size_t captureCapacity;
 } UIBuilder;
+
+typedef struct SkylineNode
+{
+    int x;
+    int y;
+    int width;
+} SkylineNode;
+
+typedef struct AtlasPage
+{
+    Image image;
+    Texture2D texture;
+    bool dirty;
+    SkylineNode *skyline;
+    int numNodes;
+} AtlasPage;
+
+typedef struct UIAtlas
+{
+    int pageWidth;
+    int pageHeight;
+    AtlasPage *pages;
+    int numPages;
+    int numImages;
+    long usedPixels;
+} UIAtlas;
+
+// A span of one of a text buffer's two stores.
+typedef struct Piece
+{
+    bool added;
+    size_t start;
+    size_t length;
+} Piece;
+
+typedef struct TextLine
+{
+    size_t start;
+    size_t length; // Not counting the newline
+    int width;
+} TextLine;
+
+// Text is kept as a piece table: the original text is never modified and
+// inserted text is appended to the added store. The buffer's contents are
+// the pieces in order. Lines are cached with their measured widths.
+typedef struct UITextBuffer
+{
+    char *original;
+    char *added;
+    size_t addedLength;
+    size_t addedCapacity;
+
+    Piece *pieces;
+    int numPieces;
+    int piecesCapacity;
+    size_t length;
+
+    TextLine *lines;
+    int numLines;
+    int linesCapacity;
+
+    int fontSize;
+    size_t cursor;
+    int firstLine;
+    int visibleLines;
+
+    // Horizontal positions at the buffer's font size, unscaled.
+    float cursorX;
+    float scrollX;
+    float visibleWidth;
+} UITextBuffer;
+
+typedef struct UIReplay
+{
+    unsigned char *data;
+    int dataSize;
+    int offset;
+    bool hasText;
+} UIReplay;
 #pragma endregion
 
 #pragma region Initialization
@@ -128,6 +333,8 @@ UIBuilder *UIBuilderAlloc(size_t maxTokens)
 
 void UIBuilderFree(UIBuilder *builder)
 {
+    UICaptureEnd(builder);
+    MemFree(builder->layoutCache);
     MemFree(builder->tokenList);
     MemFree(builder->contextStack);
     MemFree(builder);
@@ -135,617 +342,2865 @@ void UIBuilderFree(UIBuilder *builder)
 
 #pragma endregion
 
-#pragma region DSL
-static Token *pushToken(UIBuilder *builder, TokenType type)
+#pragma region Font
+// Text is measured and drawn with the font loaded by UILoadFont. Its glyph
+// images are kept in memory, so it works without a window. Until one is
+// loaded raylib's default font is used, which only InitWindow loads.
+#define FONT_GLYPHS 95
+#define FONT_ATLAS_PADDING 2
+
+static Font uiFont = {0};
+static Image uiFontAtlas = {0};
+
+// Changes whenever the font does, so cached layouts know to measure again.
+static unsigned int uiFontGeneration = 0;
+
+static Font textFont(void)
 {
-    if (builder->numTokens < builder->maxTokens - 1)
-    {
-        Token *token = &builder->tokenList[builder->numTokens];
-        token->type = type;
-        token->width = 0;
-        token->height = 0;
-        token->position = (Vector2){0, 0};
-        builder->numTokens++;
-        return token;
-    }
-    else
-    {
-        TraceLog(LOG_INFO, "UIBuilder: Max tokens reached.");
-        return NULL;
-    }
+    return uiFont.glyphs != NULL ? uiFont : GetFontDefault();
 }
 
-void UIInit(UIBuilder *builder)
+// Same rules as DrawText for the default font.
+static int textFontSize(int fontSize)
 {
-    builder->numTokens = 0;
-    builder->stackIndex = 0;
+    return fontSize < 10 ? 10 : fontSize;
+}
 
-    Token *token = pushToken(builder, TOKEN_ROOT);
-    builder->contextStack[0] = token;
+static int textSpacing(int fontSize)
+{
+    return textFontSize(fontSize) / 10;
 }
 
-void UIInitEx(UIBuilder *builder, float width, float height)
+static float glyphAdvance(Font font, int index)
 {
-    UIInit(builder);
-    Token *context = builder->contextStack[0];
-    context->width = width;
-    context->height = height;
+    if (font.glyphs[index].advanceX != 0)
+        return font.glyphs[index].advanceX;
+    return font.recs[index].width + font.glyphs[index].offsetX;
 }
 
-void UIRect(UIBuilder *builder, float width, float height, Color color)
+bool UILoadFont(const char *fileName, int fontSize)
 {
-    Token *token = pushToken(builder, TOKEN_RECT);
-    if (token)
+    int dataSize = 0;
+    unsigned char *data = LoadFileData(fileName, &dataSize);
+    GlyphInfo *glyphs = NULL;
+    if (data != NULL)
+        glyphs = LoadFontData(data, dataSize, fontSize, NULL, FONT_GLYPHS, FONT_DEFAULT);
+    UnloadFileData(data);
+
+    if (glyphs == NULL)
     {
-        token->rect.width = width;
-        token->rect.height = height;
-        token->rect.color = color;
+        TraceLog(LOG_INFO, "UIBuilder: Could not load font.");
+        return false;
     }
+
+    UIUnloadFont();
+    uiFont.baseSize = fontSize;
+    uiFont.glyphCount = FONT_GLYPHS;
+    uiFont.glyphs = glyphs;
+    uiFontAtlas = GenImageFontAtlas(glyphs, &uiFont.recs, FONT_GLYPHS, fontSize, FONT_ATLAS_PADDING, 0);
+    uiFontGeneration++;
+    return true;
 }
 
-void UIText(UIBuilder *builder, const char *text, int fontSize, Color color)
+void UIUnloadFont(void)
 {
-    Token *token = pushToken(builder, TOKEN_TEXT);
-    if (token)
+    if (uiFont.texture.id != 0)
+        UnloadTexture(uiFont.texture);
+    if (uiFont.glyphs != NULL)
+        UnloadFontData(uiFont.glyphs, uiFont.glyphCount);
+    MemFree(uiFont.recs);
+    UnloadImage(uiFontAtlas);
+
+    uiFont = (Font){0};
+    uiFontAtlas = (Image){0};
+    uiFontGeneration++;
+}
+
+// Matches MeasureText, but only reads glyph data so it works without a
+// window once a font is loaded.
+static int measureText(const char *text, int fontSize)
+{
+    static bool warned = false;
+    Font font = textFont();
+    if (font.glyphs == NULL)
     {
-        token->text.text = text;
-        token->text.fontSize = fontSize;
-        token->text.color = color;
+        if (!warned)
+            TraceLog(LOG_INFO, "UIBuilder: No font loaded, text can't be measured.");
+        warned = true;
+        return 0;
+    }
+
+    float scale = (float)textFontSize(fontSize) / font.baseSize;
+    float width = 0, lineWidth = 0;
+    int count = 0, lineCount = 0;
+
+    for (int i = 0; text[i] != '\0';)
+    {
+        int size = 0;
+        int codepoint = GetCodepointNext(&text[i], &size);
+        i += size;
+        lineCount++;
+
+        if (codepoint == '\n')
+        {
+            if (width < lineWidth)
+                width = lineWidth;
+            lineWidth = 0;
+            lineCount = 0;
+        }
+        else
+            lineWidth += glyphAdvance(font, GetGlyphIndex(font, codepoint));
+
+        if (count < lineCount)
+            count = lineCount;
     }
+
+    if (width < lineWidth)
+        width = lineWidth;
+    if (count == 0)
+        return 0;
+    return width * scale + (count - 1) * textSpacing(fontSize);
 }
 
-void UIRow(UIBuilder *builder, float spacing)
+static void drawText(const char *text, float x, float y, int fontSize, Color color)
 {
-    Token *token = pushToken(builder, TOKEN_ROW);
-    if (token)
-        token->row.spacing = spacing;
+    if (uiFont.glyphs == NULL)
+    {
+        DrawText(text, x, y, fontSize, color);
+        return;
+    }
+
+    if (uiFont.texture.id == 0)
+        uiFont.texture = LoadTextureFromImage(uiFontAtlas);
+    DrawTextEx(uiFont, text, (Vector2){x, y}, textFontSize(fontSize), textSpacing(fontSize), color);
 }
+#pragma endregion
 
-void UIRowEnd(UIBuilder *builder)
+#pragma region Atlas
+// Images are packed into fixed-size pages with a bottom-left skyline packer.
+// Each image gets a 1 pixel gutter so filtering doesn't bleed between them.
+#define ATLAS_GUTTER 1
+
+UIAtlas *UIAtlasAlloc(int pageWidth, int pageHeight)
 {
-    pushToken(builder, TOKEN_ROW_END);
+    UIAtlas *atlas = MemAlloc(sizeof(UIAtlas));
+    atlas->pageWidth = pageWidth;
+    atlas->pageHeight = pageHeight;
+    return atlas;
 }
 
-void UIColumn(UIBuilder *builder, float spacing)
+void UIAtlasFree(UIAtlas *atlas)
 {
-    Token *token = pushToken(builder, TOKEN_COLUMN);
-    if (token)
-        token->column.spacing = spacing;
+    for (int i = 0; i < atlas->numPages; i++)
+    {
+        AtlasPage *page = &atlas->pages[i];
+        if (page->texture.id != 0)
+            UnloadTexture(page->texture);
+        UnloadImage(page->image);
+        MemFree(page->skyline);
+    }
+    MemFree(atlas->pages);
+    MemFree(atlas);
 }
 
-void UIColumnEnd(UIBuilder *builder)
+static AtlasPage *addPage(UIAtlas *atlas, int width, int height)
 {
-    pushToken(builder, TOKEN_COLUMN_END);
+    atlas->pages = MemRealloc(atlas->pages, sizeof(AtlasPage) * (atlas->numPages + 1));
+    AtlasPage *page = &atlas->pages[atlas->numPages];
+    atlas->numPages++;
+
+    page->image = GenImageColor(width, height, BLANK);
+    page->texture = (Texture2D){0};
+    page->dirty = true;
+    page->skyline = MemAlloc(sizeof(SkylineNode) * (width + 1));
+    page->skyline[0] = (SkylineNode){0, 0, width};
+    page->numNodes = 1;
+    return page;
 }
 
-void UIAlignH(UIBuilder *builder, AlignH align)
+// Returns the y at which a width x height box fits on top of the skyline
+// starting at node index, or -1 if it doesn't fit.
+static int skylineFit(AtlasPage *page, int index, int width, int height)
 {
-    Token *token = pushToken(builder, TOKEN_ALIGN_H);
-    if (token)
-        token->alignH.align = align;
+    int x = page->skyline[index].x;
+    if (x + width > page->image.width)
+        return -1;
+
+    int y = 0;
+    int remaining = width;
+    for (int i = index; remaining > 0; i++)
+    {
+        if (page->skyline[i].y > y)
+            y = page->skyline[i].y;
+        if (y + height > page->image.height)
+            return -1;
+        remaining -= page->skyline[i].width;
+    }
+    return y;
 }
 
-void UIAlignV(UIBuilder *builder, AlignV align)
+static bool skylinePack(AtlasPage *page, int width, int height, int *outX, int *outY)
 {
-    Token *token = pushToken(builder, TOKEN_ALIGN_V);
-    if (token)
-        token->alignV.align = align;
+    int bestIndex = -1;
+    int bestY = page->image.height;
+    int bestWidth = page->image.width + 1;
+
+    for (int i = 0; i < page->numNodes; i++)
+    {
+        int y = skylineFit(page, i, width, height);
+        if (y >= 0 && (y < bestY || (y == bestY && page->skyline[i].width < bestWidth)))
+        {
+            bestIndex = i;
+            bestY = y;
+            bestWidth = page->skyline[i].width;
+        }
+    }
+
+    if (bestIndex < 0)
+        return false;
+
+    SkylineNode *nodes = page->skyline;
+    int x = nodes[bestIndex].x;
+
+    memmove(&nodes[bestIndex + 1], &nodes[bestIndex], sizeof(SkylineNode) * (page->numNodes - bestIndex));
+    nodes[bestIndex] = (SkylineNode){x, bestY + height, width};
+    page->numNodes++;
+
+    // Trim the nodes now covered by the new one.
+    for (int i = bestIndex + 1; i < page->numNodes; i++)
+    {
+        int overlap = nodes[i - 1].x + nodes[i - 1].width - nodes[i].x;
+        if (overlap <= 0)
+            break;
+
+        nodes[i].x += overlap;
+        nodes[i].width -= overlap;
+        if (nodes[i].width > 0)
+            break;
+
+        memmove(&nodes[i], &nodes[i + 1], sizeof(SkylineNode) * (page->numNodes - i - 1));
+        page->numNodes--;
+        i--;
+    }
+
+    // Merge neighbours at the same height.
+    for (int i = 0; i < page->numNodes - 1; i++)
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            memmove(&nodes[i + 1], &nodes[i + 2], sizeof(SkylineNode) * (page->numNodes - i - 2));
+            page->numNodes--;
+            i--;
+        }
+    }
+
+    *outX = x;
+    *outY = bestY;
+    return true;
 }
 
-void UIAlign(UIBuilder *builder, AlignH alignH, AlignV alignV)
+UIAtlasImage UIAtlasAdd(UIAtlas *atlas, Image image)
 {
-    Token *token = pushToken(builder, TOKEN_ALIGN);
-    if (token)
+    int width = image.width + ATLAS_GUTTER;
+    int height = image.height + ATLAS_GUTTER;
+    int x = 0, y = 0;
+    int pageIndex = -1;
+
+    if (width > atlas->pageWidth || height > atlas->pageHeight)
     {
-        token->align.alignH = alignH;
-        token->align.alignV = alignV;
+        // Too big to share a page.
+        AtlasPage *page = addPage(atlas, image.width, image.height);
+        page->skyline[0].y = image.height;
+        pageIndex = atlas->numPages - 1;
+    }
+    else
+    {
+        for (int i = 0; i < atlas->numPages && pageIndex < 0; i++)
+            if (skylinePack(&atlas->pages[i], width, height, &x, &y))
+                pageIndex = i;
+
+        if (pageIndex < 0)
+        {
+            skylinePack(addPage(atlas, atlas->pageWidth, atlas->pageHeight), width, height, &x, &y);
+            pageIndex = atlas->numPages - 1;
+        }
+    }
+
+    Image pixels = image;
+    if (image.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+    {
+        pixels = ImageCopy(image);
+        ImageFormat(&pixels, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
     }
+
+    AtlasPage *page = &atlas->pages[pageIndex];
+    Color *dst = page->image.data;
+    Color *src = pixels.data;
+    for (int row = 0; row < image.height; row++)
+        memcpy(&dst[(y + row) * page->image.width + x], &src[row * image.width], sizeof(Color) * image.width);
+    page->dirty = true;
+
+    if (pixels.data != image.data)
+        UnloadImage(pixels);
+
+    atlas->numImages++;
+    atlas->usedPixels += (long)image.width * image.height;
+    return (UIAtlasImage){atlas, pageIndex, (Rectangle){x, y, image.width, image.height}};
 }
 
-void UIPadding(UIBuilder *builder, float spacing)
+UIAtlasStats UIAtlasGetStats(UIAtlas *atlas)
 {
-    Token *token = pushToken(builder, TOKEN_PADDING);
-    if (token)
-        token->padding.spacing = spacing;
+    UIAtlasStats stats = {0};
+    stats.pages = atlas->numPages;
+    stats.images = atlas->numImages;
+    stats.usedPixels = atlas->usedPixels;
+    for (int i = 0; i < atlas->numPages; i++)
+        stats.totalPixels += (long)atlas->pages[i].image.width * atlas->pages[i].image.height;
+    stats.occupancy = stats.totalPixels > 0 ? (float)stats.usedPixels / stats.totalPixels : 0;
+    return stats;
 }
 
-void UIBorder(UIBuilder *builder, float thickness, Color color)
+static Texture2D atlasTexture(UIAtlas *atlas, int pageIndex)
 {
-    Token *token = pushToken(builder, TOKEN_BORDER);
-    if (token)
+    AtlasPage *page = &atlas->pages[pageIndex];
+    if (page->dirty)
     {
-        token->border.thickness = thickness;
-        token->border.color = color;
+        if (page->texture.id == 0)
+            page->texture = LoadTextureFromImage(page->image);
+        else
+            UpdateTexture(page->texture, page->image.data);
+        page->dirty = false;
     }
+    return page->texture;
 }
+#pragma endregion
 
-void UIShim(UIBuilder *builder, float width, float height)
+#pragma region Text Buffer
+static void copyText(UITextBuffer *buffer, size_t start, size_t length, char *dst)
 {
-    Token *token = pushToken(builder, TOKEN_SHIM);
-    if (token)
+    size_t offset = 0;
+    for (int i = 0; i < buffer->numPieces && length > 0; i++)
     {
-        token->width = width;
-        token->height = height;
+        Piece *piece = &buffer->pieces[i];
+        if (start < offset + piece->length)
+        {
+            size_t skip = start - offset;
+            size_t count = piece->length - skip < length ? piece->length - skip : length;
+            const char *store = piece->added ? buffer->added : buffer->original;
+            memcpy(dst, &store[piece->start + skip], count);
+            dst += count;
+            start += count;
+            length -= count;
+        }
+        offset += piece->length;
     }
 }
 
-void UIShimH(UIBuilder *builder, float width)
+static unsigned char charAt(UITextBuffer *buffer, size_t position)
 {
-    Token *token = pushToken(builder, TOKEN_SHIM_H);
-    if (token)
-        token->width = width;
+    char c = 0;
+    copyText(buffer, position, 1, &c);
+    return c;
 }
 
-void UIShimV(UIBuilder *builder, float height)
+// Index of the line containing position.
+static int lineAt(UITextBuffer *buffer, size_t position)
 {
-    Token *token = pushToken(builder, TOKEN_SHIM_V);
-    if (token)
-        token->height = height;
+    int low = 0;
+    int high = buffer->numLines - 1;
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (buffer->lines[mid].start <= position)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
 }
 
-void UIBackground(UIBuilder *builder, Color color)
+// Replaces lines first to last with the lines now found in the text they
+// covered, which changed length by delta. Lines after them are moved along
+// by delta without being measured again.
+static void relineRange(UITextBuffer *buffer, int first, int last, long delta)
 {
-    Token *token = pushToken(builder, TOKEN_BACKROUND);
-    if (token)
-        token->background.color = color;
-}
+    size_t start = buffer->lines[first].start;
+    size_t length = buffer->lines[last].start + buffer->lines[last].length + delta - start;
+    char *text = MemAlloc(length + 1);
+    copyText(buffer, start, length, text);
+
+    int count = 1;
+    for (size_t i = 0; i < length; i++)
+        if (text[i] == '\n')
+            count++;
+
+    int numLines = buffer->numLines - (last - first + 1) + count;
+    if (numLines > buffer->linesCapacity)
+    {
+        while (buffer->linesCapacity < numLines)
+            buffer->linesCapacity *= 2;
+        buffer->lines = MemRealloc(buffer->lines, sizeof(TextLine) * buffer->linesCapacity);
+    }
 
-#pragma endregion
+    TextLine *lines = buffer->lines;
+    memmove(&lines[first + count], &lines[last + 1], sizeof(TextLine) * (buffer->numLines - last - 1));
+    buffer->numLines = numLines;
+    for (int i = first + count; i < numLines; i++)
+        lines[i].start += delta;
 
-#pragma region stack
-static void pushContext(UIBuilder *builder, Token *token)
+    size_t lineStart = 0;
+    int line = first;
+    for (size_t i = 0; i <= length; i++)
+    {
+        if (i == length || text[i] == '\n')
+        {
+            text[i] = '\0';
+            lines[line] = (TextLine){start + lineStart, i - lineStart, measureText(&text[lineStart], buffer->fontSize)};
+            line++;
+            lineStart = i + 1;
+        }
+    }
+
+    MemFree(text);
+}
+
+static void insertPieces(UITextBuffer *buffer, int index, int count)
 {
-    if (builder->stackIndex < builder->maxTokens - 1)
+    if (buffer->numPieces + count > buffer->piecesCapacity)
     {
-        builder->stackIndex++;
-        builder->contextStack[builder->stackIndex] = token;
+        buffer->piecesCapacity = buffer->piecesCapacity * 2 + count;
+        buffer->pieces = MemRealloc(buffer->pieces, sizeof(Piece) * buffer->piecesCapacity);
     }
-    else
-        TraceLog(LOG_INFO, "UIBuilder: Max context stack reached.");
+
+    memmove(&buffer->pieces[index + count], &buffer->pieces[index], sizeof(Piece) * (buffer->numPieces - index));
+    buffer->numPieces += count;
 }
 
-static void popContext(UIBuilder *builder)
+// Scrolls so that the cursor is visible.
+static void scrollToCursor(UITextBuffer *buffer)
 {
-    if (builder->stackIndex > 0)
-        builder->stackIndex--;
+    int line = lineAt(buffer, buffer->cursor);
+    int visible = buffer->visibleLines > 0 ? buffer->visibleLines : 1;
+
+    if (line < buffer->firstLine)
+        buffer->firstLine = line;
+    else if (line >= buffer->firstLine + visible)
+        buffer->firstLine = line - visible + 1;
+
+    if (buffer->firstLine > buffer->numLines - 1)
+        buffer->firstLine = buffer->numLines - 1;
+
+    // Leaves a pixel at the right edge for the caret.
+    if (buffer->visibleWidth <= 0)
+        return;
+    if (buffer->cursorX < buffer->scrollX)
+        buffer->scrollX = buffer->cursorX;
+    else if (buffer->cursorX + 1 > buffer->scrollX + buffer->visibleWidth)
+        buffer->scrollX = buffer->cursorX + 1 - buffer->visibleWidth;
+    if (buffer->scrollX < 0)
+        buffer->scrollX = 0;
 }
 
-static Token *peekContext(UIBuilder *builder)
+// Measures the text before the cursor on its line. Only called when the text
+// or the cursor changes, so drawing never has to measure.
+static void cursorMoved(UITextBuffer *buffer)
 {
-    return builder->contextStack[builder->stackIndex];
+    TextLine *line = &buffer->lines[lineAt(buffer, buffer->cursor)];
+    size_t length = buffer->cursor - line->start;
+    char *text = MemAlloc(length + 1);
+    copyText(buffer, line->start, length, text);
+    text[length] = '\0';
+    buffer->cursorX = measureText(text, buffer->fontSize);
+    MemFree(text);
+
+    scrollToCursor(buffer);
 }
-#pragma endregion
 
-#pragma region Sizes
-static void updateContextSize(UIBuilder *builder, Token *token)
+UITextBuffer *UITextBufferAlloc(const char *text, int fontSize)
 {
-    bool cont = false;
-    do
+    UITextBuffer *buffer = MemAlloc(sizeof(UITextBuffer));
+    size_t length = text ? strlen(text) : 0;
+
+    buffer->original = MemAlloc(length + 1);
+    memcpy(buffer->original, text ? text : "", length);
+    buffer->length = length;
+    // Text is never drawn smaller than this, so lines are spaced to match.
+    buffer->fontSize = textFontSize(fontSize);
+
+    buffer->piecesCapacity = 16;
+    buffer->pieces = MemAlloc(sizeof(Piece) * buffer->piecesCapacity);
+    if (length > 0)
     {
-        cont = false;
-        Token *context = peekContext(builder);
+        buffer->pieces[0] = (Piece){false, 0, length};
+        buffer->numPieces = 1;
+    }
 
-        switch (context->type)
-        {
-        case TOKEN_ROW:
-        {
-            if (token->type == TOKEN_ROW_END)
-            {
-                context->width -= context->row.spacing;
-                popContext(builder);
-                token = context;
-                cont = true;
-            }
-            else
-            {
-                context->width += token->width + context->row.spacing;
-                if (context->height < token->height)
-                    context->height = token->height;
-            }
-        }
-        break;
+    buffer->linesCapacity = 16;
+    buffer->lines = MemAlloc(sizeof(TextLine) * buffer->linesCapacity);
+    buffer->numLines = 1;
+    relineRange(buffer, 0, 0, length);
+    return buffer;
+}
 
+void UITextBufferFree(UITextBuffer *buffer)
+{
+    MemFree(buffer->original);
+    MemFree(buffer->added);
+    MemFree(buffer->pieces);
+    MemFree(buffer->lines);
+    MemFree(buffer);
+}
+
+size_t UITextBufferLength(UITextBuffer *buffer)
+{
+    return buffer->length;
+}
+
+// Copies the buffer's contents into text, which must have room for
+// UITextBufferLength + 1 bytes.
+void UITextBufferGetText(UITextBuffer *buffer, char *text)
+{
+    copyText(buffer, 0, buffer->length, text);
+    text[buffer->length] = '\0';
+}
+
+void UITextBufferInsert(UITextBuffer *buffer, size_t position, const char *text)
+{
+    size_t length = strlen(text);
+    if (length == 0)
+        return;
+    if (position > buffer->length)
+        position = buffer->length;
+
+    if (buffer->addedLength + length > buffer->addedCapacity)
+    {
+        size_t capacity = buffer->addedCapacity ? buffer->addedCapacity * 2 : 1024;
+        while (capacity < buffer->addedLength + length)
+            capacity *= 2;
+        buffer->added = MemRealloc(buffer->added, capacity);
+        buffer->addedCapacity = capacity;
+    }
+
+    size_t addedStart = buffer->addedLength;
+    memcpy(&buffer->added[addedStart], text, length);
+    buffer->addedLength += length;
+
+    int line = lineAt(buffer, position);
+
+    int i = 0;
+    size_t offset = 0;
+    while (i < buffer->numPieces && offset + buffer->pieces[i].length < position)
+    {
+        offset += buffer->pieces[i].length;
+        i++;
+    }
+
+    Piece piece = {true, addedStart, length};
+    if (i < buffer->numPieces && position == offset + buffer->pieces[i].length &&
+        buffer->pieces[i].added && buffer->pieces[i].start + buffer->pieces[i].length == addedStart)
+    {
+        // Typing onto the end of the last insert.
+        buffer->pieces[i].length += length;
+    }
+    else if (i < buffer->numPieces && position > offset && position < offset + buffer->pieces[i].length)
+    {
+        Piece left = buffer->pieces[i];
+        Piece right = left;
+        left.length = position - offset;
+        right.start += left.length;
+        right.length -= left.length;
+
+        insertPieces(buffer, i + 1, 2);
+        buffer->pieces[i] = left;
+        buffer->pieces[i + 1] = piece;
+        buffer->pieces[i + 2] = right;
+    }
+    else
+    {
+        int index = i < buffer->numPieces && position > offset ? i + 1 : i;
+        insertPieces(buffer, index, 1);
+        buffer->pieces[index] = piece;
+    }
+
+    buffer->length += length;
+    relineRange(buffer, line, line, length);
+
+    if (buffer->cursor >= position)
+        buffer->cursor += length;
+    cursorMoved(buffer);
+}
+
+void UITextBufferDelete(UITextBuffer *buffer, size_t position, size_t length)
+{
+    if (position >= buffer->length)
+        return;
+    if (length > buffer->length - position)
+        length = buffer->length - position;
+    if (length == 0)
+        return;
+
+    size_t end = position + length;
+    int first = lineAt(buffer, position);
+    int last = lineAt(buffer, end);
+
+    size_t offset = 0;
+    for (int i = 0; i < buffer->numPieces && offset < end;)
+    {
+        Piece *piece = &buffer->pieces[i];
+        size_t pieceStart = offset;
+        size_t pieceEnd = offset + piece->length;
+        offset = pieceEnd;
+
+        if (pieceEnd <= position)
+            i++;
+        else if (pieceStart >= position && pieceEnd <= end)
+        {
+            memmove(piece, piece + 1, sizeof(Piece) * (buffer->numPieces - i - 1));
+            buffer->numPieces--;
+        }
+        else if (pieceStart < position && pieceEnd > end)
+        {
+            Piece right = *piece;
+            right.start += end - pieceStart;
+            right.length = pieceEnd - end;
+            piece->length = position - pieceStart;
+            insertPieces(buffer, i + 1, 1);
+            buffer->pieces[i + 1] = right;
+            break;
+        }
+        else if (pieceStart < position)
+        {
+            piece->length = position - pieceStart;
+            i++;
+        }
+        else
+        {
+            piece->start += end - pieceStart;
+            piece->length = pieceEnd - end;
+            i++;
+        }
+    }
+
+    buffer->length -= length;
+    relineRange(buffer, first, last, -(long)length);
+
+    if (buffer->cursor >= end)
+        buffer->cursor -= length;
+    else if (buffer->cursor > position)
+        buffer->cursor = position;
+    cursorMoved(buffer);
+}
+
+static size_t previousChar(UITextBuffer *buffer, size_t position)
+{
+    if (position == 0)
+        return 0;
+    position--;
+    while (position > 0 && (charAt(buffer, position) & 0xC0) == 0x80)
+        position--;
+    return position;
+}
+
+static size_t nextChar(UITextBuffer *buffer, size_t position)
+{
+    if (position >= buffer->length)
+        return buffer->length;
+    position++;
+    while (position < buffer->length && (charAt(buffer, position) & 0xC0) == 0x80)
+        position++;
+    return position;
+}
+
+static void moveToLine(UITextBuffer *buffer, int line)
+{
+    TextLine *current = &buffer->lines[lineAt(buffer, buffer->cursor)];
+    TextLine *target = &buffer->lines[line];
+    size_t column = buffer->cursor - current->start;
+    size_t position = target->start + (column < target->length ? column : target->length);
+
+    while (position > target->start && (charAt(buffer, position) & 0xC0) == 0x80)
+        position--;
+    buffer->cursor = position;
+}
+
+// Editing and movement keys also act while held down.
+static bool keyPressed(int key)
+{
+    return IsKeyPressed(key) || IsKeyPressedRepeat(key);
+}
+
+// Edits the buffer at its cursor using this frame's keyboard input.
+void UITextBufferUpdate(UITextBuffer *buffer)
+{
+    int codepoint = 0;
+    while ((codepoint = GetCharPressed()) > 0)
+    {
+        int size = 0;
+        char text[5] = {0};
+        memcpy(text, CodepointToUTF8(codepoint, &size), 4);
+        text[size] = '\0';
+        UITextBufferInsert(buffer, buffer->cursor, text);
+    }
+
+    int line = lineAt(buffer, buffer->cursor);
+    size_t cursor = buffer->cursor;
+
+    if (IsKeyPressed(KEY_ENTER))
+        UITextBufferInsert(buffer, buffer->cursor, "\n");
+    else if (keyPressed(KEY_BACKSPACE) && buffer->cursor > 0)
+    {
+        size_t start = previousChar(buffer, buffer->cursor);
+        UITextBufferDelete(buffer, start, buffer->cursor - start);
+    }
+    else if (keyPressed(KEY_DELETE))
+        UITextBufferDelete(buffer, buffer->cursor, nextChar(buffer, buffer->cursor) - buffer->cursor);
+    else if (keyPressed(KEY_LEFT))
+        buffer->cursor = previousChar(buffer, buffer->cursor);
+    else if (keyPressed(KEY_RIGHT))
+        buffer->cursor = nextChar(buffer, buffer->cursor);
+    else if (keyPressed(KEY_UP) && line > 0)
+        moveToLine(buffer, line - 1);
+    else if (keyPressed(KEY_DOWN) && line < buffer->numLines - 1)
+        moveToLine(buffer, line + 1);
+    else if (IsKeyPressed(KEY_HOME))
+        buffer->cursor = buffer->lines[line].start;
+    else if (IsKeyPressed(KEY_END))
+        buffer->cursor = buffer->lines[line].start + buffer->lines[line].length;
+
+    if (buffer->cursor != cursor)
+        cursorMoved(buffer);
+}
+#pragma endregion
+
+#pragma region DSL
+static Token *pushToken(UIBuilder *builder, TokenType type)
+{
+    if (builder->numTokens < builder->maxTokens - 1)
+    {
+        Token *token = &builder->tokenList[builder->numTokens];
+        token->type = type;
+        token->width = 0;
+        token->height = 0;
+        token->position = (Vector2){0, 0};
+        token->last = builder->numTokens;
+        builder->numTokens++;
+        return token;
+    }
+    else
+    {
+        TraceLog(LOG_INFO, "UIBuilder: Max tokens reached.");
+        return NULL;
+    }
+}
+
+void UIInit(UIBuilder *builder)
+{
+    builder->numTokens = 0;
+    builder->stackIndex = 0;
+    builder->numPrototypes = 0;
+    builder->layoutPhase = LAYOUT_SIZES;
+    builder->layoutIndex = 0;
+
+    Token *token = pushToken(builder, TOKEN_ROOT);
+    builder->contextStack[0] = token;
+}
+
+void UIInitEx(UIBuilder *builder, float width, float height)
+{
+    UIInit(builder);
+    Token *context = builder->contextStack[0];
+    context->width = width;
+    context->height = height;
+}
+
+void UIRect(UIBuilder *builder, float width, float height, Color color)
+{
+    Token *token = pushToken(builder, TOKEN_RECT);
+    if (token)
+    {
+        token->rect.width = width;
+        token->rect.height = height;
+        token->rect.color = color;
+    }
+}
+
+void UIText(UIBuilder *builder, const char *text, int fontSize, Color color)
+{
+    Token *token = pushToken(builder, TOKEN_TEXT);
+    if (token)
+    {
+        token->text.text = text;
+        token->text.fontSize = fontSize;
+        token->text.color = color;
+    }
+}
+
+void UIImage(UIBuilder *builder, UIAtlasImage image, float width, float height, Color tint)
+{
+    Token *token = pushToken(builder, TOKEN_IMAGE);
+    if (token)
+    {
+        token->image.image = image;
+        token->image.width = width;
+        token->image.height = height;
+        token->image.tint = tint;
+    }
+}
+
+// Declares that its child is the prototype with the given id. Prototypes
+// are laid out but not drawn, and take up no space in their parent.
+void UIPrototype(UIBuilder *builder, int prototypeId)
+{
+    Token *token = pushToken(builder, TOKEN_PROTOTYPE);
+    if (!token)
+        return;
+
+    token->prototype.id = prototypeId;
+
+    int i = 0;
+    while (i < builder->numPrototypes && builder->prototypes[i].id != prototypeId)
+        i++;
+
+    if (i == MAX_PROTOTYPES)
+    {
+        TraceLog(LOG_INFO, "UIBuilder: Max prototypes reached.");
+        return;
+    }
+
+    if (i == builder->numPrototypes)
+        builder->numPrototypes++;
+    builder->prototypes[i] = (PrototypeEntry){prototypeId, token - builder->tokenList};
+}
+
+// Draws a copy of a prototype declared earlier in the frame, with its text
+// and fill colors replaced by any overrides that are set.
+void UIInstance(UIBuilder *builder, int prototypeId, UIInstanceOverrides overrides)
+{
+    Token *token = pushToken(builder, TOKEN_INSTANCE);
+    if (!token)
+        return;
+
+    token->instance.id = prototypeId;
+    token->instance.prototype = 0;
+    token->instance.overrides = overrides;
+
+    for (int i = 0; i < builder->numPrototypes; i++)
+        if (builder->prototypes[i].id == prototypeId)
+            token->instance.prototype = builder->prototypes[i].token;
+
+    if (token->instance.prototype == 0)
+        TraceLog(LOG_INFO, "UIBuilder: Instance of undeclared prototype.");
+}
+
+// An editable text box showing the lines of buffer that fit inside it.
+void UITextInput(UIBuilder *builder, UITextBuffer *buffer, float width, float height, Color color)
+{
+    Token *token = pushToken(builder, TOKEN_TEXT_INPUT);
+    if (token)
+    {
+        token->textInput.buffer = buffer;
+        token->textInput.width = width;
+        token->textInput.height = height;
+        token->textInput.color = color;
+    }
+}
+
+void UIRow(UIBuilder *builder, float spacing)
+{
+    Token *token = pushToken(builder, TOKEN_ROW);
+    if (token)
+        token->row.spacing = spacing;
+}
+
+void UIRowEnd(UIBuilder *builder)
+{
+    pushToken(builder, TOKEN_ROW_END);
+}
+
+void UIColumn(UIBuilder *builder, float spacing)
+{
+    Token *token = pushToken(builder, TOKEN_COLUMN);
+    if (token)
+        token->column.spacing = spacing;
+}
+
+void UIColumnEnd(UIBuilder *builder)
+{
+    pushToken(builder, TOKEN_COLUMN_END);
+}
+
+void UIAlignH(UIBuilder *builder, AlignH align)
+{
+    Token *token = pushToken(builder, TOKEN_ALIGN_H);
+    if (token)
+        token->alignH.align = align;
+}
+
+void UIAlignV(UIBuilder *builder, AlignV align)
+{
+    Token *token = pushToken(builder, TOKEN_ALIGN_V);
+    if (token)
+        token->alignV.align = align;
+}
+
+void UIAlign(UIBuilder *builder, AlignH alignH, AlignV alignV)
+{
+    Token *token = pushToken(builder, TOKEN_ALIGN);
+    if (token)
+    {
+        token->align.alignH = alignH;
+        token->align.alignV = alignV;
+    }
+}
+
+void UIPadding(UIBuilder *builder, float spacing)
+{
+    Token *token = pushToken(builder, TOKEN_PADDING);
+    if (token)
+        token->padding.spacing = spacing;
+}
+
+void UIBorder(UIBuilder *builder, float thickness, Color color)
+{
+    Token *token = pushToken(builder, TOKEN_BORDER);
+    if (token)
+    {
+        token->border.thickness = thickness;
+        token->border.color = color;
+    }
+}
+
+void UIShim(UIBuilder *builder, float width, float height)
+{
+    Token *token = pushToken(builder, TOKEN_SHIM);
+    if (token)
+    {
+        token->width = width;
+        token->height = height;
+    }
+}
+
+void UIShimH(UIBuilder *builder, float width)
+{
+    Token *token = pushToken(builder, TOKEN_SHIM_H);
+    if (token)
+        token->width = width;
+}
+
+void UIShimV(UIBuilder *builder, float height)
+{
+    Token *token = pushToken(builder, TOKEN_SHIM_V);
+    if (token)
+        token->height = height;
+}
+
+void UIBackground(UIBuilder *builder, Color color)
+{
+    Token *token = pushToken(builder, TOKEN_BACKROUND);
+    if (token)
+        token->background.color = color;
+}
+
+// Does the work of UIAlign, UIBackground, UIBorder and UIPadding in that
+// order as a single modifier.
+void UIPanel(UIBuilder *builder, UIPanelStyle style)
+{
+    Token *token = pushToken(builder, TOKEN_PANEL);
+    if (token)
+        token->panel.style = style;
+}
+
+// Moves, scales and fades its child when it's drawn, without changing its
+// layout. The child is scaled about its center.
+void UITransform(UIBuilder *builder, Vector2 offset, float scale, float alpha)
+{
+    Token *token = pushToken(builder, TOKEN_TRANSFORM);
+    if (token)
+    {
+        token->transform.offset = offset;
+        token->transform.scale = scale;
+        token->transform.alpha = alpha;
+    }
+}
+
+#pragma endregion
+
+#pragma region stack
+static void pushContext(UIBuilder *builder, Token *token)
+{
+    if (builder->stackIndex < builder->maxTokens - 1)
+    {
+        builder->stackIndex++;
+        builder->contextStack[builder->stackIndex] = token;
+    }
+    else
+        TraceLog(LOG_INFO, "UIBuilder: Max context stack reached.");
+}
+
+static void popContext(UIBuilder *builder)
+{
+    if (builder->stackIndex > 0)
+        builder->stackIndex--;
+}
+
+static Token *peekContext(UIBuilder *builder)
+{
+    return builder->contextStack[builder->stackIndex];
+}
+#pragma endregion
+
+#pragma region Sizes
+static void updateContextSize(UIBuilder *builder, Token *token)
+{
+    // Every element completed by this token ends with it.
+    size_t last = token - builder->tokenList;
+
+    bool cont = false;
+    do
+    {
+        cont = false;
+        token->last = last;
+        Token *context = peekContext(builder);
+
+        switch (context->type)
+        {
+        case TOKEN_ROW:
+        {
+            if (token->type == TOKEN_ROW_END)
+            {
+                context->width -= context->row.spacing;
+                popContext(builder);
+                token = context;
+                cont = true;
+            }
+            else
+            {
+                context->width += token->width + context->row.spacing;
+                if (context->height < token->height)
+                    context->height = token->height;
+            }
+        }
+        break;
+
+        case TOKEN_COLUMN:
+        {
+            if (token->type == TOKEN_COLUMN_END)
+            {
+                context->height -= context->column.spacing;
+                popContext(builder);
+                token = context;
+                cont = true;
+            }
+            else
+            {
+                context->height += token->height + context->column.spacing;
+                if (context->width < token->width)
+                    context->width = token->width;
+            }
+        }
+        break;
+
+        case TOKEN_ALIGN_H:
+        {
+            context->width = token->width;
+            if (context->height < token->height)
+                context->height = token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_ALIGN_V:
+        {
+            context->height = token->height;
+            if (context->width < token->width)
+                context->width = token->width;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_ALIGN:
+        {
+            context->width = token->width;
+            context->height = token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_PADDING:
+        {
+            context->width += token->width + context->padding.spacing * 2;
+            context->height += token->height + context->padding.spacing * 2;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_PANEL:
+        {
+            context->width = token->width + context->panel.style.padding * 2;
+            context->height = token->height + context->panel.style.padding * 2;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_BORDER:
+        {
+            context->width += token->width;
+            context->height += token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_SHIM:
+        {
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_SHIM_H:
+        {
+            context->height = token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_SHIM_V:
+        {
+            context->width = token->width;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_BACKROUND:
+        {
+            context->width = token->width;
+            context->height = token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        case TOKEN_TRANSFORM:
+        {
+            context->width = token->width;
+            context->height = token->height;
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+
+        // Prototypes don't add to their parent's size.
+        case TOKEN_PROTOTYPE:
+        {
+            context->width = token->width;
+            context->height = token->height;
+            context->last = last;
+            popContext(builder);
+        }
+        break;
+
+        default:
+            break;
+        }
+    } while (cont);
+}
+
+static void sizeToken(UIBuilder *builder, size_t i)
+{
+    Token *token = &builder->tokenList[i];
+    switch (token->type)
+    {
+    // Root
+    case TOKEN_ROOT:
+        break;
+
+    // Primitives
+    case TOKEN_RECT:
+    {
+        token->width = token->rect.width;
+        token->height = token->rect.height;
+        updateContextSize(builder, token);
+    }
+    break;
+    case TOKEN_IMAGE:
+    {
+        token->width = token->image.width;
+        token->height = token->image.height;
+        updateContextSize(builder, token);
+    }
+    break;
+    case TOKEN_TEXT_INPUT:
+    {
+        UITextBuffer *buffer = token->textInput.buffer;
+        token->width = token->textInput.width;
+        token->height = token->textInput.height;
+        if (buffer != NULL)
+        {
+            buffer->visibleLines = token->height / buffer->fontSize;
+            buffer->visibleWidth = token->width;
+            scrollToCursor(buffer);
+        }
+        updateContextSize(builder, token);
+    }
+    break;
+    case TOKEN_INSTANCE:
+    {
+        Token *prototype = &builder->tokenList[token->instance.prototype];
+        token->width = token->instance.prototype ? prototype->width : 0;
+        token->height = token->instance.prototype ? prototype->height : 0;
+        updateContextSize(builder, token);
+    }
+    break;
+    case TOKEN_TEXT:
+    {
+        token->width = measureText(token->text.text, token->text.fontSize);
+        token->height = token->text.fontSize;
+        updateContextSize(builder, token);
+    }
+    break;
+
+    // Container Ends
+    case TOKEN_ROW_END:
+        updateContextSize(builder, token);
+        break;
+    case TOKEN_COLUMN_END:
+        updateContextSize(builder, token);
+        break;
+
+    // Shims keep their declared size
+    case TOKEN_SHIM:
+    case TOKEN_SHIM_H:
+    case TOKEN_SHIM_V:
+        pushContext(builder, token);
+        break;
+
+    // Containers and Modifiers
+    default:
+        token->width = 0;
+        token->height = 0;
+        pushContext(builder, token);
+        break;
+    }
+}
+
+static unsigned long long hashBytes(unsigned long long hash, const void *data, size_t size)
+{
+    // FNV-1a
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+// Hashes everything that can change the result of layout. Colors and the
+// like are left out since they're only read when drawing.
+static unsigned long long layoutHash(UIBuilder *builder)
+{
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    hash = hashBytes(hash, &builder->numTokens, sizeof(builder->numTokens));
+    hash = hashBytes(hash, &uiFontGeneration, sizeof(uiFontGeneration));
+
+    for (size_t i = 0; i < builder->numTokens; i++)
+    {
+        Token *token = &builder->tokenList[i];
+        hash = hashBytes(hash, &token->type, sizeof(token->type));
+
+        switch (token->type)
+        {
+        case TOKEN_ROOT:
+        case TOKEN_SHIM:
+            hash = hashBytes(hash, &token->width, sizeof(token->width));
+            hash = hashBytes(hash, &token->height, sizeof(token->height));
+            break;
+        case TOKEN_SHIM_H:
+            hash = hashBytes(hash, &token->width, sizeof(token->width));
+            break;
+        case TOKEN_SHIM_V:
+            hash = hashBytes(hash, &token->height, sizeof(token->height));
+            break;
+        case TOKEN_RECT:
+            hash = hashBytes(hash, &token->rect.width, sizeof(token->rect.width));
+            hash = hashBytes(hash, &token->rect.height, sizeof(token->rect.height));
+            break;
+        case TOKEN_TEXT:
+            hash = hashBytes(hash, &token->text.fontSize, sizeof(token->text.fontSize));
+            hash = hashBytes(hash, token->text.text, strlen(token->text.text));
+            break;
+        case TOKEN_IMAGE:
+            hash = hashBytes(hash, &token->image.width, sizeof(token->image.width));
+            hash = hashBytes(hash, &token->image.height, sizeof(token->image.height));
+            break;
+        case TOKEN_ROW:
+            hash = hashBytes(hash, &token->row.spacing, sizeof(token->row.spacing));
+            break;
         case TOKEN_COLUMN:
+            hash = hashBytes(hash, &token->column.spacing, sizeof(token->column.spacing));
+            break;
+        case TOKEN_ALIGN_H:
+            hash = hashBytes(hash, &token->alignH.align, sizeof(token->alignH.align));
+            break;
+        case TOKEN_ALIGN_V:
+            hash = hashBytes(hash, &token->alignV.align, sizeof(token->alignV.align));
+            break;
+        case TOKEN_ALIGN:
+            hash = hashBytes(hash, &token->align.alignH, sizeof(token->align.alignH));
+            hash = hashBytes(hash, &token->align.alignV, sizeof(token->align.alignV));
+            break;
+        case TOKEN_PADDING:
+            hash = hashBytes(hash, &token->padding.spacing, sizeof(token->padding.spacing));
+            break;
+        case TOKEN_INSTANCE:
+            hash = hashBytes(hash, &token->instance.id, sizeof(token->instance.id));
+            break;
+        case TOKEN_TEXT_INPUT:
+            hash = hashBytes(hash, &token->textInput.width, sizeof(token->textInput.width));
+            hash = hashBytes(hash, &token->textInput.height, sizeof(token->textInput.height));
+            break;
+        case TOKEN_PROTOTYPE:
+            hash = hashBytes(hash, &token->prototype.id, sizeof(token->prototype.id));
+            break;
+        case TOKEN_PANEL:
+            hash = hashBytes(hash, &token->panel.style.alignH, sizeof(token->panel.style.alignH));
+            hash = hashBytes(hash, &token->panel.style.alignV, sizeof(token->panel.style.alignV));
+            hash = hashBytes(hash, &token->panel.style.padding, sizeof(token->panel.style.padding));
+            break;
+        default:
+            break;
+        }
+    }
+
+    return hash;
+}
+
+static void setSizes(UIBuilder *builder)
+{
+    for (size_t i = 0; i < builder->numTokens; i++)
+        sizeToken(builder, i);
+
+    if (builder->stackIndex > 0)
+        TraceLog(LOG_INFO, "UIBuilder: Context stack not empty.");
+}
+#pragma endregion
+
+#pragma region Positions
+static void updateContextPosition(UIBuilder *builder, Token *token)
+{
+    bool cont = false;
+    do
+    {
+        cont = false;
+        Token *context = peekContext(builder);
+
+        switch (context->type)
         {
-            if (token->type == TOKEN_COLUMN_END)
+        // Root
+        case TOKEN_ROOT:
+            break;
+
+        // Containers
+        case TOKEN_ROW:
+        {
+            if (token->type == TOKEN_ROW_END)
             {
-                context->height -= context->column.spacing;
                 popContext(builder);
                 token = context;
                 cont = true;
             }
             else
+                context->position.x += token->width + context->row.spacing;
+        }
+        break;
+        case TOKEN_COLUMN:
+        {
+            if (token->type == TOKEN_COLUMN_END)
             {
-                context->height += token->height + context->column.spacing;
-                if (context->width < token->width)
-                    context->width = token->width;
+                popContext(builder);
+                token = context;
+                cont = true;
             }
+            else
+                context->position.y += token->height + context->column.spacing;
+        }
+        break;
+
+        // Prototypes don't move their parent along.
+        case TOKEN_PROTOTYPE:
+            popContext(builder);
+            break;
+
+        // Modifiers
+        default:
+        {
+            popContext(builder);
+            token = context;
+            cont = true;
+        }
+        break;
+        }
+    } while (cont);
+}
+
+static void positionToken(UIBuilder *builder, size_t i)
+{
+    Token *token = &builder->tokenList[i];
+    switch (token->type)
+    {
+    case TOKEN_ROOT:
+        break;
+
+    case TOKEN_RECT:
+    {
+        token->position = peekContext(builder)->position;
+        updateContextPosition(builder, token);
+    }
+    break;
+
+    case TOKEN_IMAGE:
+    {
+        token->position = peekContext(builder)->position;
+        updateContextPosition(builder, token);
+    }
+    break;
+
+    case TOKEN_INSTANCE:
+    {
+        token->position = peekContext(builder)->position;
+        updateContextPosition(builder, token);
+    }
+    break;
+
+    case TOKEN_TEXT_INPUT:
+    {
+        token->position = peekContext(builder)->position;
+        updateContextPosition(builder, token);
+    }
+    break;
+
+    case TOKEN_TEXT:
+    {
+        token->position = peekContext(builder)->position;
+        updateContextPosition(builder, token);
+    }
+    break;
+
+    case TOKEN_ROW:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_ROW_END:
+        updateContextPosition(builder, token);
+        break;
+
+    case TOKEN_COLUMN:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_COLUMN_END:
+    {
+        Token *columnContext = peekContext(builder);
+        popContext(builder);
+        updateContextPosition(builder, columnContext);
+    }
+    break;
+
+    case TOKEN_ALIGN_H:
+    {
+        Token *nextToken = &builder->tokenList[i + 1];
+        Token *context = peekContext(builder);
+        token->position = context->position;
+        float width = context->width;
+
+        switch (token->alignH.align)
+        {
+        case LEFT:
+            break;
+        case CENTER:
+            token->position.x += width / 2 - nextToken->width / 2;
+            break;
+        case RIGHT:
+            token->position.x += width - nextToken->width;
+            break;
+        }
+
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_ALIGN_V:
+    {
+        Token *nextToken = &builder->tokenList[i + 1];
+        Token *context = peekContext(builder);
+        token->position = context->position;
+        float height = context->height;
+
+        switch (token->alignV.align)
+        {
+        case TOP:
+            break;
+        case MIDDLE:
+            token->position.y += height / 2 - nextToken->height / 2;
+            break;
+        case BOTTOM:
+            token->position.y += height - nextToken->height;
+            break;
+        }
+
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_ALIGN:
+    {
+        Token *nextToken = &builder->tokenList[i + 1];
+        Token *context = peekContext(builder);
+        token->position = context->position;
+        float width = context->width;
+        float height = context->height;
+
+        switch (token->align.alignH)
+        {
+        case LEFT:
+            break;
+        case CENTER:
+            token->position.x += width / 2 - nextToken->width / 2;
+            break;
+        case RIGHT:
+            token->position.x += width - nextToken->width;
+            break;
+        }
+
+        switch (token->align.alignV)
+        {
+        case TOP:
+            break;
+        case MIDDLE:
+            token->position.y += height / 2 - nextToken->height / 2;
+            break;
+        case BOTTOM:
+            token->position.y += height - nextToken->height;
+            break;
+        }
+
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_PADDING:
+    {
+        token->position = peekContext(builder)->position;
+        token->position.x += token->padding.spacing;
+        token->position.y += token->padding.spacing;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_PANEL:
+    {
+        Token *context = peekContext(builder);
+        UIPanelStyle *style = &token->panel.style;
+        token->position = context->position;
+
+        switch (style->alignH)
+        {
+        case LEFT:
+            break;
+        case CENTER:
+            token->position.x += context->width / 2 - token->width / 2;
+            break;
+        case RIGHT:
+            token->position.x += context->width - token->width;
+            break;
         }
-        break;
 
-        case TOKEN_ALIGN_H:
+        switch (style->alignV)
         {
-            context->width = token->width;
-            if (context->height < token->height)
-                context->height = token->height;
-            popContext(builder);
-            token = context;
-            cont = true;
+        case TOP:
+            break;
+        case MIDDLE:
+            token->position.y += context->height / 2 - token->height / 2;
+            break;
+        case BOTTOM:
+            token->position.y += context->height - token->height;
+            break;
         }
-        break;
 
-        case TOKEN_ALIGN_V:
+        // The panel's position is where its child goes, inside the padding.
+        token->position.x += style->padding;
+        token->position.y += style->padding;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_BORDER:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_SHIM:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_SHIM_H:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_SHIM_V:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_BACKROUND:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_TRANSFORM:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+
+    case TOKEN_PROTOTYPE:
+    {
+        token->position = peekContext(builder)->position;
+        pushContext(builder, token);
+    }
+    break;
+    }
+}
+
+static void setPositions(UIBuilder *builder, Vector2 position)
+{
+    Token *root = peekContext(builder);
+    root->position = position;
+
+    for (size_t i = 0; i < builder->numTokens; i++)
+        positionToken(builder, i);
+}
+#pragma endregion
+
+#pragma region Capture
+// Capture files start with a header followed by one record per frame:
+//   u32 frame size in bytes, u32 token count, then for each token a u8 tag
+//   and that type's parameters. Text is inlined with its terminating NUL.
+// Values are written in native byte order.
+//
+// Bump the version whenever the format changes. Version 2 only added tags,
+// so version 1 files can still be replayed.
+#define CAPTURE_MAGIC 0x50434955 // "UICP"
+#define CAPTURE_VERSION 2
+
+// Tags written to capture files. These never change, so that captures stay
+// readable when TokenType is reordered. New token types get new tags.
+typedef enum CaptureTag
+{
+    CAPTURE_ROOT = 0,
+    CAPTURE_RECT = 1,
+    CAPTURE_TEXT = 2,
+    CAPTURE_ROW = 3,
+    CAPTURE_ROW_END = 4,
+    CAPTURE_COLUMN = 5,
+    CAPTURE_COLUMN_END = 6,
+    CAPTURE_ALIGN_H = 7,
+    CAPTURE_ALIGN_V = 8,
+    CAPTURE_ALIGN = 9,
+    CAPTURE_PADDING = 10,
+    CAPTURE_BORDER = 11,
+    CAPTURE_SHIM = 12,
+    CAPTURE_SHIM_H = 13,
+    CAPTURE_SHIM_V = 14,
+    CAPTURE_BACKGROUND = 15,
+
+    // Version 2
+    CAPTURE_IMAGE = 16,
+    CAPTURE_PANEL = 17,
+    CAPTURE_TRANSFORM = 18,
+    CAPTURE_PROTOTYPE = 19,
+    CAPTURE_INSTANCE = 20,
+    CAPTURE_TEXT_INPUT = 21
+} CaptureTag;
+
+static const unsigned char captureTags[] = {
+    [TOKEN_ROOT] = CAPTURE_ROOT,
+    [TOKEN_RECT] = CAPTURE_RECT,
+    [TOKEN_TEXT] = CAPTURE_TEXT,
+    [TOKEN_IMAGE] = CAPTURE_IMAGE,
+    [TOKEN_INSTANCE] = CAPTURE_INSTANCE,
+    [TOKEN_TEXT_INPUT] = CAPTURE_TEXT_INPUT,
+    [TOKEN_ROW] = CAPTURE_ROW,
+    [TOKEN_ROW_END] = CAPTURE_ROW_END,
+    [TOKEN_COLUMN] = CAPTURE_COLUMN,
+    [TOKEN_COLUMN_END] = CAPTURE_COLUMN_END,
+    [TOKEN_ALIGN_H] = CAPTURE_ALIGN_H,
+    [TOKEN_ALIGN_V] = CAPTURE_ALIGN_V,
+    [TOKEN_ALIGN] = CAPTURE_ALIGN,
+    [TOKEN_PADDING] = CAPTURE_PADDING,
+    [TOKEN_BORDER] = CAPTURE_BORDER,
+    [TOKEN_SHIM] = CAPTURE_SHIM,
+    [TOKEN_SHIM_H] = CAPTURE_SHIM_H,
+    [TOKEN_SHIM_V] = CAPTURE_SHIM_V,
+    [TOKEN_BACKROUND] = CAPTURE_BACKGROUND,
+    [TOKEN_PANEL] = CAPTURE_PANEL,
+    [TOKEN_TRANSFORM] = CAPTURE_TRANSFORM,
+    [TOKEN_PROTOTYPE] = CAPTURE_PROTOTYPE,
+};
+
+// Finds the token type for a tag read from a capture file.
+static bool tokenTypeForTag(unsigned char tag, TokenType *type)
+{
+    for (size_t i = 0; i < sizeof(captureTags) / sizeof(captureTags[0]); i++)
+    {
+        if (captureTags[i] == tag)
         {
-            context->height = token->height;
-            if (context->width < token->width)
-                context->width = token->width;
-            popContext(builder);
-            token = context;
-            cont = true;
+            *type = i;
+            return true;
         }
-        break;
+    }
+    return false;
+}
 
-        case TOKEN_ALIGN:
+static void captureBytes(UIBuilder *builder, const void *data, size_t size)
+{
+    if (builder->captureSize + size > builder->captureCapacity)
+    {
+        size_t capacity = builder->captureCapacity ? builder->captureCapacity * 2 : 4096;
+        while (capacity < builder->captureSize + size)
+            capacity *= 2;
+        builder->captureBuffer = MemRealloc(builder->captureBuffer, capacity);
+        builder->captureCapacity = capacity;
+    }
+
+    memcpy(&builder->captureBuffer[builder->captureSize], data, size);
+    builder->captureSize += size;
+}
+
+static void captureU8(UIBuilder *builder, unsigned char value) { captureBytes(builder, &value, sizeof(value)); }
+static void captureU32(UIBuilder *builder, unsigned int value) { captureBytes(builder, &value, sizeof(value)); }
+static void captureFloat(UIBuilder *builder, float value) { captureBytes(builder, &value, sizeof(value)); }
+static void captureColor(UIBuilder *builder, Color value) { captureBytes(builder, &value, sizeof(value)); }
+
+static void captureFrame(UIBuilder *builder)
+{
+    builder->captureSize = 0;
+    captureU32(builder, 0);
+    captureU32(builder, builder->numTokens);
+
+    for (size_t i = 0; i < builder->numTokens; i++)
+    {
+        Token *token = &builder->tokenList[i];
+        captureU8(builder, captureTags[token->type]);
+
+        switch (token->type)
         {
-            context->width = token->width;
-            context->height = token->height;
-            popContext(builder);
-            token = context;
-            cont = true;
+        case TOKEN_ROOT:
+            captureFloat(builder, token->width);
+            captureFloat(builder, token->height);
+            break;
+        case TOKEN_RECT:
+            captureFloat(builder, token->rect.width);
+            captureFloat(builder, token->rect.height);
+            captureColor(builder, token->rect.color);
+            break;
+        case TOKEN_IMAGE:
+            // The atlas itself isn't captured, only where the image was.
+            captureU32(builder, token->image.image.page);
+            captureBytes(builder, &token->image.image.source, sizeof(Rectangle));
+            captureFloat(builder, token->image.width);
+            captureFloat(builder, token->image.height);
+            captureColor(builder, token->image.tint);
+            break;
+        case TOKEN_TEXT:
+        {
+            unsigned int length = strlen(token->text.text);
+            captureU32(builder, token->text.fontSize);
+            captureColor(builder, token->text.color);
+            captureU32(builder, length);
+            captureBytes(builder, token->text.text, length + 1);
         }
         break;
-
+        case TOKEN_ROW:
+            captureFloat(builder, token->row.spacing);
+            break;
+        case TOKEN_COLUMN:
+            captureFloat(builder, token->column.spacing);
+            break;
+        case TOKEN_ALIGN_H:
+            captureU8(builder, token->alignH.align);
+            break;
+        case TOKEN_ALIGN_V:
+            captureU8(builder, token->alignV.align);
+            break;
+        case TOKEN_ALIGN:
+            captureU8(builder, token->align.alignH);
+            captureU8(builder, token->align.alignV);
+            break;
         case TOKEN_PADDING:
+            captureFloat(builder, token->padding.spacing);
+            break;
+        case TOKEN_BORDER:
+            captureFloat(builder, token->border.thickness);
+            captureColor(builder, token->border.color);
+            break;
+        case TOKEN_SHIM:
+            captureFloat(builder, token->width);
+            captureFloat(builder, token->height);
+            break;
+        case TOKEN_SHIM_H:
+            captureFloat(builder, token->width);
+            break;
+        case TOKEN_SHIM_V:
+            captureFloat(builder, token->height);
+            break;
+        case TOKEN_BACKROUND:
+            captureColor(builder, token->background.color);
+            break;
+        case TOKEN_PANEL:
+            captureU8(builder, token->panel.style.alignH);
+            captureU8(builder, token->panel.style.alignV);
+            captureColor(builder, token->panel.style.background);
+            captureFloat(builder, token->panel.style.borderThickness);
+            captureColor(builder, token->panel.style.borderColor);
+            captureFloat(builder, token->panel.style.padding);
+            break;
+        case TOKEN_TRANSFORM:
+            captureFloat(builder, token->transform.offset.x);
+            captureFloat(builder, token->transform.offset.y);
+            captureFloat(builder, token->transform.scale);
+            captureFloat(builder, token->transform.alpha);
+            break;
+        case TOKEN_PROTOTYPE:
+            captureU32(builder, token->prototype.id);
+            break;
+        case TOKEN_TEXT_INPUT:
+            // Only the box is captured, not the buffer's contents.
+            captureFloat(builder, token->textInput.width);
+            captureFloat(builder, token->textInput.height);
+            captureColor(builder, token->textInput.color);
+            break;
+        case TOKEN_INSTANCE:
         {
-            context->width += token->width + context->padding.spacing * 2;
-            context->height += token->height + context->padding.spacing * 2;
-            popContext(builder);
-            token = context;
-            cont = true;
+            const char *text = token->instance.overrides.text;
+            unsigned int length = text ? strlen(text) : 0;
+            captureU32(builder, token->instance.id);
+            captureColor(builder, token->instance.overrides.color);
+            captureU8(builder, text != NULL);
+            captureU32(builder, length);
+            if (text != NULL)
+                captureBytes(builder, text, length + 1);
         }
         break;
+        default:
+            break;
+        }
+    }
 
-        case TOKEN_BORDER:
+    unsigned int frameSize = builder->captureSize;
+    memcpy(builder->captureBuffer, &frameSize, sizeof(frameSize));
+    fwrite(builder->captureBuffer, 1, builder->captureSize, builder->captureFile);
+}
+
+bool UICaptureBegin(UIBuilder *builder, const char *fileName)
+{
+    UICaptureEnd(builder);
+
+    // Only append to a capture file with the same format.
+    FILE *existing = fopen(fileName, "rb");
+    if (existing != NULL)
+    {
+        unsigned int header[2] = {0};
+        size_t read = fread(header, 1, sizeof(header), existing);
+        fclose(existing);
+
+        if (read > 0 && (read != sizeof(header) || header[0] != CAPTURE_MAGIC || header[1] != CAPTURE_VERSION))
         {
-            context->width += token->width;
-            context->height += token->height;
-            popContext(builder);
-            token = context;
-            cont = true;
+            TraceLog(LOG_INFO, "UIBuilder: Capture file has a different format.");
+            return false;
         }
-        break;
+    }
 
-        case TOKEN_SHIM:
+    builder->captureFile = fopen(fileName, "ab");
+    if (builder->captureFile == NULL)
+    {
+        TraceLog(LOG_INFO, "UIBuilder: Could not open capture file.");
+        return false;
+    }
+
+    // Some C libraries report 0 for a new append stream until it's written.
+    fseek(builder->captureFile, 0, SEEK_END);
+    if (ftell(builder->captureFile) == 0)
+    {
+        unsigned int header[2] = {CAPTURE_MAGIC, CAPTURE_VERSION};
+        fwrite(header, sizeof(header), 1, builder->captureFile);
+    }
+    return true;
+}
+
+void UICaptureEnd(UIBuilder *builder)
+{
+    if (builder->captureFile != NULL)
+        fclose(builder->captureFile);
+    builder->captureFile = NULL;
+
+    MemFree(builder->captureBuffer);
+    builder->captureBuffer = NULL;
+    builder->captureSize = 0;
+    builder->captureCapacity = 0;
+}
+#pragma endregion
+
+#pragma region Replay
+static bool replayRead(UIReplay *replay, int end, void *value, int size)
+{
+    if (replay->offset + size > end)
+        return false;
+    memcpy(value, &replay->data[replay->offset], size);
+    replay->offset += size;
+    return true;
+}
+
+UIReplay *UIReplayOpen(const char *fileName)
+{
+    int dataSize = 0;
+    unsigned char *data = LoadFileData(fileName, &dataSize);
+
+    unsigned int header[2] = {0};
+    if (data != NULL && dataSize >= (int)sizeof(header))
+        memcpy(header, data, sizeof(header));
+
+    if (header[0] != CAPTURE_MAGIC || header[1] < 1 || header[1] > CAPTURE_VERSION)
+    {
+        TraceLog(LOG_INFO, "UIBuilder: Not a capture file.");
+        UnloadFileData(data);
+        return NULL;
+    }
+
+    UIReplay *replay = MemAlloc(sizeof(UIReplay));
+    replay->data = data;
+    replay->dataSize = dataSize;
+    replay->offset = sizeof(header);
+    replay->hasText = false;
+    return replay;
+}
+
+void UIReplayClose(UIReplay *replay)
+{
+    UnloadFileData(replay->data);
+    MemFree(replay);
+}
+
+// Re-declares the next captured frame on the builder. Text points into the
+// replay's data, so the frame is valid until the replay is closed.
+bool UIReplayNextFrame(UIReplay *replay, UIBuilder *builder)
+{
+    int start = replay->offset;
+    unsigned int frameSize = 0;
+    unsigned int numTokens = 0;
+    if (!replayRead(replay, replay->dataSize, &frameSize, sizeof(frameSize)) ||
+        frameSize > (unsigned int)(replay->dataSize - start))
+        return false;
+
+    int end = start + frameSize;
+    bool ok = replayRead(replay, end, &numTokens, sizeof(numTokens));
+    replay->hasText = false;
+    UIInit(builder);
+
+    for (unsigned int i = 0; ok && i < numTokens; i++)
+    {
+        unsigned char tag = 0;
+        TokenType type = TOKEN_ROOT;
+        unsigned char a = 0, b = 0;
+        float x = 0, y = 0;
+        unsigned int n = 0, length = 0;
+        Color color = {0};
+        ok = replayRead(replay, end, &tag, sizeof(tag)) && tokenTypeForTag(tag, &type);
+
+        switch (type)
         {
-            popContext(builder);
-            token = context;
-            cont = true;
+        case TOKEN_ROOT:
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y));
+            if (ok)
+                UIInitEx(builder, x, y);
+            break;
+        case TOKEN_RECT:
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y)) &&
+                 replayRead(replay, end, &color, sizeof(color));
+            if (ok)
+                UIRect(builder, x, y, color);
+            break;
+        case TOKEN_IMAGE:
+        {
+            UIAtlasImage image = {0};
+            ok = ok && replayRead(replay, end, &n, sizeof(n)) && replayRead(replay, end, &image.source, sizeof(image.source)) &&
+                 replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y)) &&
+                 replayRead(replay, end, &color, sizeof(color));
+            image.page = n;
+            if (ok)
+                UIImage(builder, image, x, y, color);
         }
         break;
-
+        case TOKEN_TEXT:
+            ok = ok && replayRead(replay, end, &n, sizeof(n)) && replayRead(replay, end, &color, sizeof(color)) &&
+                 replayRead(replay, end, &length, sizeof(length)) && length < (unsigned int)(end - replay->offset) &&
+                 replay->data[replay->offset + length] == '\0';
+            if (ok)
+            {
+                UIText(builder, (const char *)&replay->data[replay->offset], n, color);
+                replay->offset += length + 1;
+                replay->hasText = true;
+            }
+            break;
+        case TOKEN_ROW:
+            ok = ok && replayRead(replay, end, &x, sizeof(x));
+            if (ok)
+                UIRow(builder, x);
+            break;
+        case TOKEN_ROW_END:
+            UIRowEnd(builder);
+            break;
+        case TOKEN_COLUMN:
+            ok = ok && replayRead(replay, end, &x, sizeof(x));
+            if (ok)
+                UIColumn(builder, x);
+            break;
+        case TOKEN_COLUMN_END:
+            UIColumnEnd(builder);
+            break;
+        case TOKEN_ALIGN_H:
+            ok = ok && replayRead(replay, end, &a, sizeof(a));
+            if (ok)
+                UIAlignH(builder, a);
+            break;
+        case TOKEN_ALIGN_V:
+            ok = ok && replayRead(replay, end, &a, sizeof(a));
+            if (ok)
+                UIAlignV(builder, a);
+            break;
+        case TOKEN_ALIGN:
+            ok = ok && replayRead(replay, end, &a, sizeof(a)) && replayRead(replay, end, &b, sizeof(b));
+            if (ok)
+                UIAlign(builder, a, b);
+            break;
+        case TOKEN_PADDING:
+            ok = ok && replayRead(replay, end, &x, sizeof(x));
+            if (ok)
+                UIPadding(builder, x);
+            break;
+        case TOKEN_BORDER:
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &color, sizeof(color));
+            if (ok)
+                UIBorder(builder, x, color);
+            break;
+        case TOKEN_SHIM:
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y));
+            if (ok)
+                UIShim(builder, x, y);
+            break;
         case TOKEN_SHIM_H:
+            ok = ok && replayRead(replay, end, &x, sizeof(x));
+            if (ok)
+                UIShimH(builder, x);
+            break;
+        case TOKEN_SHIM_V:
+            ok = ok && replayRead(replay, end, &y, sizeof(y));
+            if (ok)
+                UIShimV(builder, y);
+            break;
+        case TOKEN_BACKROUND:
+            ok = ok && replayRead(replay, end, &color, sizeof(color));
+            if (ok)
+                UIBackground(builder, color);
+            break;
+        case TOKEN_PANEL:
         {
-            context->height = token->height;
-            popContext(builder);
-            token = context;
-            cont = true;
+            UIPanelStyle style = {0};
+            ok = ok && replayRead(replay, end, &a, sizeof(a)) && replayRead(replay, end, &b, sizeof(b)) &&
+                 replayRead(replay, end, &style.background, sizeof(style.background)) &&
+                 replayRead(replay, end, &style.borderThickness, sizeof(style.borderThickness)) &&
+                 replayRead(replay, end, &style.borderColor, sizeof(style.borderColor)) &&
+                 replayRead(replay, end, &style.padding, sizeof(style.padding));
+            style.alignH = a;
+            style.alignV = b;
+            if (ok)
+                UIPanel(builder, style);
         }
         break;
-
-        case TOKEN_SHIM_V:
+        case TOKEN_TRANSFORM:
         {
-            context->width = token->width;
-            popContext(builder);
-            token = context;
-            cont = true;
+            float scale = 0, alpha = 0;
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y)) &&
+                 replayRead(replay, end, &scale, sizeof(scale)) && replayRead(replay, end, &alpha, sizeof(alpha));
+            if (ok)
+                UITransform(builder, (Vector2){x, y}, scale, alpha);
+        }
+        break;
+        case TOKEN_PROTOTYPE:
+            ok = ok && replayRead(replay, end, &n, sizeof(n));
+            if (ok)
+                UIPrototype(builder, n);
+            break;
+        case TOKEN_TEXT_INPUT:
+            ok = ok && replayRead(replay, end, &x, sizeof(x)) && replayRead(replay, end, &y, sizeof(y)) &&
+                 replayRead(replay, end, &color, sizeof(color));
+            if (ok)
+                UITextInput(builder, NULL, x, y, color);
+            break;
+        case TOKEN_INSTANCE:
+        {
+            UIInstanceOverrides overrides = {0};
+            ok = ok && replayRead(replay, end, &n, sizeof(n)) && replayRead(replay, end, &overrides.color, sizeof(overrides.color)) &&
+                 replayRead(replay, end, &a, sizeof(a)) && replayRead(replay, end, &length, sizeof(length));
+            if (ok && a)
+            {
+                ok = length < (unsigned int)(end - replay->offset) && replay->data[replay->offset + length] == '\0';
+                overrides.text = (const char *)&replay->data[replay->offset];
+                replay->offset += length + 1;
+                replay->hasText = true;
+            }
+            if (ok)
+                UIInstance(builder, n, overrides);
         }
         break;
+        default:
+            ok = false;
+            break;
+        }
+    }
+
+    if (!ok)
+        TraceLog(LOG_INFO, "UIBuilder: Corrupt capture frame.");
+
+    replay->offset = end;
+    return ok;
+}
+
+// Whether the last frame read has any text, which needs a font to lay out.
+bool UIReplayFrameHasText(UIReplay *replay)
+{
+    return replay->hasText;
+}
+#pragma endregion
+
+#pragma region Raster
+// Extra space between lines of text, as in DrawTextEx.
+#define TEXT_LINE_SPACING 2
+
+static inline unsigned char blendChannel(unsigned char src, unsigned char dst, unsigned int alpha)
+{
+    unsigned int value = src * alpha + dst * (255 - alpha);
+    return (unsigned char)((value + 1 + (value >> 8)) >> 8);
+}
+
+// Spans are filled and blended 4 pixels at a time with SSE2 or NEON where
+// available. Both compute exactly what blendChannel does, so output is the
+// same on every platform. The scalar loops handle the remaining pixels.
+static void fillSpan(Color *dst, int count, Color color)
+{
+    int i = 0;
+#if defined(UI_SSE2)
+    unsigned int packed;
+    memcpy(&packed, &color, sizeof(packed));
+    __m128i value = _mm_set1_epi32(packed);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128((__m128i *)&dst[i], value);
+#elif defined(UI_NEON)
+    unsigned int packed;
+    memcpy(&packed, &color, sizeof(packed));
+    uint8x16_t value = vreinterpretq_u8_u32(vdupq_n_u32(packed));
+    for (; i + 4 <= count; i += 4)
+        vst1q_u8((unsigned char *)&dst[i], value);
+#endif
+    for (; i < count; i++)
+        dst[i] = color;
+}
+
+static void blendSpan(Color *dst, int count, Color color)
+{
+    unsigned int alpha = color.a;
+    int i = 0;
+#if defined(UI_SSE2)
+    // Two pixels per 16 bit half: src * alpha is constant, dst * (255 - alpha)
+    // fits in 16 bits, and the rounding divide by 255 is done with shifts.
+    __m128i source = _mm_setr_epi16(color.r * alpha, color.g * alpha, color.b * alpha, 255 * alpha,
+                                    color.r * alpha, color.g * alpha, color.b * alpha, 255 * alpha);
+    __m128i inverse = _mm_set1_epi16(255 - alpha);
+    __m128i one = _mm_set1_epi16(1);
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i pixels = _mm_loadu_si128((__m128i *)&dst[i]);
+        __m128i lo = _mm_add_epi16(source, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), inverse));
+        __m128i hi = _mm_add_epi16(source, _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), inverse));
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+    }
+#elif defined(UI_NEON)
+    const uint16_t terms[8] = {color.r * alpha, color.g * alpha, color.b * alpha, 255 * alpha,
+                               color.r * alpha, color.g * alpha, color.b * alpha, 255 * alpha};
+    uint16x8_t source = vld1q_u16(terms);
+    uint8x8_t inverse = vdup_n_u8(255 - alpha);
+    uint16x8_t one = vdupq_n_u16(1);
+    for (; i + 4 <= count; i += 4)
+    {
+        uint8x16_t pixels = vld1q_u8((unsigned char *)&dst[i]);
+        uint16x8_t lo = vmlal_u8(source, vget_low_u8(pixels), inverse);
+        uint16x8_t hi = vmlal_u8(source, vget_high_u8(pixels), inverse);
+        lo = vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8));
+        hi = vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8));
+        vst1q_u8((unsigned char *)&dst[i], vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        dst[i].r = blendChannel(color.r, dst[i].r, alpha);
+        dst[i].g = blendChannel(color.g, dst[i].g, alpha);
+        dst[i].b = blendChannel(color.b, dst[i].b, alpha);
+        dst[i].a = blendChannel(255, dst[i].a, alpha);
+    }
+}
 
-        case TOKEN_BACKROUND:
+static void rasterRect(DrawTarget *target, int x0, int y0, int x1, int y1, Color color)
+{
+    if (color.a == 0)
+        return;
+
+    if (x0 < target->clipX0)
+        x0 = target->clipX0;
+    if (y0 < target->clipY0)
+        y0 = target->clipY0;
+    if (x1 > target->clipX1)
+        x1 = target->clipX1;
+    if (y1 > target->clipY1)
+        y1 = target->clipY1;
+    if (x0 >= x1 || y0 >= y1)
+        return;
+
+    Color *pixels = target->image->data;
+    int stride = target->image->width;
+    for (int y = y0; y < y1; y++)
+    {
+        if (color.a == 255)
+            fillSpan(&pixels[y * stride + x0], x1 - x0, color);
+        else
+            blendSpan(&pixels[y * stride + x0], x1 - x0, color);
+    }
+}
+
+// Blends src scaled (nearest neighbour) into the given destination rectangle.
+static void rasterImage(DrawTarget *target, Image src, Rectangle source, int x0, int y0, int width, int height, Color tint)
+{
+    if (width <= 0 || height <= 0 || tint.a == 0)
+        return;
+
+    int cx0 = x0 < target->clipX0 ? target->clipX0 : x0;
+    int cy0 = y0 < target->clipY0 ? target->clipY0 : y0;
+    int cx1 = x0 + width > target->clipX1 ? target->clipX1 : x0 + width;
+    int cy1 = y0 + height > target->clipY1 ? target->clipY1 : y0 + height;
+    if (cx0 >= cx1 || cy0 >= cy1)
+        return;
+
+    Color *pixels = target->image->data;
+    Color *srcPixels = src.data;
+    int stride = target->image->width;
+    float stepX = source.width / width;
+    float stepY = source.height / height;
+
+    for (int y = cy0; y < cy1; y++)
+    {
+        Color *srcRow = &srcPixels[(int)(source.y + (y - y0) * stepY) * src.width];
+        Color *dst = &pixels[y * stride];
+        for (int x = cx0; x < cx1; x++)
         {
-            context->width = token->width;
-            context->height = token->height;
-            popContext(builder);
-            token = context;
-            cont = true;
+            Color s = srcRow[(int)(source.x + (x - x0) * stepX)];
+            unsigned int alpha = s.a * tint.a / 255;
+            if (alpha == 0)
+                continue;
+            dst[x].r = blendChannel(s.r * tint.r / 255, dst[x].r, alpha);
+            dst[x].g = blendChannel(s.g * tint.g / 255, dst[x].g, alpha);
+            dst[x].b = blendChannel(s.b * tint.b / 255, dst[x].b, alpha);
+            dst[x].a = blendChannel(255, dst[x].a, alpha);
         }
+    }
+}
+
+// Blends color into the destination rectangle using a glyph image's
+// coverage, scaled with nearest neighbour sampling.
+static void rasterGlyph(DrawTarget *target, Image glyph, int x0, int y0, int width, int height, Color color)
+{
+    int bytes, alphaOffset;
+    switch (glyph.format)
+    {
+    case PIXELFORMAT_UNCOMPRESSED_GRAYSCALE:
+        bytes = 1, alphaOffset = 0;
+        break;
+    case PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA:
+        bytes = 2, alphaOffset = 1;
+        break;
+    case PIXELFORMAT_UNCOMPRESSED_R8G8B8A8:
+        bytes = 4, alphaOffset = 3;
         break;
+    default:
+        return;
+    }
 
-        default:
-            break;
+    if (width <= 0 || height <= 0)
+        return;
+
+    int cx0 = x0 < target->clipX0 ? target->clipX0 : x0;
+    int cy0 = y0 < target->clipY0 ? target->clipY0 : y0;
+    int cx1 = x0 + width > target->clipX1 ? target->clipX1 : x0 + width;
+    int cy1 = y0 + height > target->clipY1 ? target->clipY1 : y0 + height;
+
+    Color *pixels = target->image->data;
+    unsigned char *coverage = glyph.data;
+    int stride = target->image->width;
+
+    for (int y = cy0; y < cy1; y++)
+    {
+        unsigned char *srcRow = &coverage[(y - y0) * glyph.height / height * glyph.width * bytes];
+        Color *dst = &pixels[y * stride];
+        for (int x = cx0; x < cx1; x++)
+        {
+            unsigned int alpha = srcRow[(x - x0) * glyph.width / width * bytes + alphaOffset] * color.a / 255;
+            if (alpha == 0)
+                continue;
+            dst[x].r = blendChannel(color.r, dst[x].r, alpha);
+            dst[x].g = blendChannel(color.g, dst[x].g, alpha);
+            dst[x].b = blendChannel(color.b, dst[x].b, alpha);
+            dst[x].a = blendChannel(255, dst[x].a, alpha);
         }
-    } while (cont);
+    }
 }
 
-static void setSizes(UIBuilder *builder)
+// Draws text glyph by glyph from the font's glyph images, laid out the same
+// way as DrawTextEx. Glyphs outside the clip bounds are skipped.
+static void rasterText(DrawTarget *target, const char *text, int x, int y, int fontSize, Color color)
 {
-    for (size_t i = 0; i < builder->numTokens; i++)
+    Font font = textFont();
+    if (font.glyphs == NULL || color.a == 0)
+        return;
+
+    fontSize = textFontSize(fontSize);
+    float scale = (float)fontSize / font.baseSize;
+    int spacing = textSpacing(fontSize);
+    float offsetX = 0;
+    float offsetY = 0;
+
+    for (int i = 0; text[i] != '\0';)
     {
-        Token *token = &builder->tokenList[i];
-        switch (token->type)
-        {
-        // Root
-        case TOKEN_ROOT:
-            break;
+        int size = 0;
+        int codepoint = GetCodepointNext(&text[i], &size);
+        i += size;
 
-        // Primitives
-        case TOKEN_RECT:
+        if (codepoint == '\n')
         {
-            token->width = token->rect.width;
-            token->height = token->rect.height;
-            updateContextSize(builder, token);
+            offsetX = 0;
+            offsetY += fontSize + TEXT_LINE_SPACING;
+            continue;
         }
-        break;
-        case TOKEN_TEXT:
+
+        int lineY = y + offsetY;
+        if (lineY >= target->clipY1)
+            break;
+
+        float glyphX = x + offsetX;
+        if (glyphX >= target->clipX1 || lineY + fontSize <= target->clipY0)
         {
-            token->width = MeasureText(token->text.text, token->text.fontSize);
-            token->height = token->text.fontSize;
-            updateContextSize(builder, token);
+            // Nothing else on this line is visible.
+            const char *next = strchr(&text[i], '\n');
+            if (next == NULL)
+                break;
+            i = next - text;
+            continue;
         }
-        break;
 
-        // Container Ends
-        case TOKEN_ROW_END:
-            updateContextSize(builder, token);
-            break;
-        case TOKEN_COLUMN_END:
-            updateContextSize(builder, token);
-            break;
+        int index = GetGlyphIndex(font, codepoint);
+        GlyphInfo *glyph = &font.glyphs[index];
+        float advance = glyphAdvance(font, index) * scale;
 
-        // Containers and Modifiers
-        default:
-            pushContext(builder, token);
-            break;
+        int x1 = roundf(glyphX + (glyph->offsetX + glyph->image.width) * scale);
+        if (codepoint != ' ' && codepoint != '\t' && x1 > target->clipX0)
+        {
+            int x0 = roundf(glyphX + glyph->offsetX * scale);
+            int y0 = roundf(lineY + glyph->offsetY * scale);
+            int y1 = roundf(lineY + (glyph->offsetY + glyph->image.height) * scale);
+            rasterGlyph(target, glyph->image, x0, y0, x1 - x0, y1 - y0, color);
         }
-    }
 
-    if (builder->stackIndex > 0)
-        TraceLog(LOG_INFO, "UIBuilder: Context stack not empty.");
+        offsetX += advance + spacing;
+    }
 }
 #pragma endregion
 
 #pragma region Draw
-static void updateContextPosition(UIBuilder *builder, Token *token)
+// Number of tokens UILayoutStep processes between checks of the clock.
+#define LAYOUT_STEP_TOKENS 64
+
+static Rectangle targetBounds(DrawTarget *target, Vector2 position, float width, float height)
 {
-    bool cont = false;
-    do
+    if (target->scale == 1)
+        return (Rectangle){position.x + target->offset.x, position.y + target->offset.y, width, height};
+
+    // Snap edges to whole pixels so scaled neighbours don't overlap or leave gaps.
+    float x0 = roundf(target->offset.x + position.x * target->scale);
+    float y0 = roundf(target->offset.y + position.y * target->scale);
+    float x1 = roundf(target->offset.x + (position.x + width) * target->scale);
+    float y1 = roundf(target->offset.y + (position.y + height) * target->scale);
+    return (Rectangle){x0, y0, x1 - x0, y1 - y0};
+}
+
+// Text is drawn at a whole font size so it stays crisp when scaled.
+static int targetFontSize(DrawTarget *target, int fontSize)
+{
+    if (target->scale == 1)
+        return fontSize;
+
+    int scaled = roundf(fontSize * target->scale);
+    return scaled > 0 ? scaled : 1;
+}
+
+static Color targetColor(DrawTarget *target, Color color)
+{
+    if (target->alpha < 1)
+        color.a = color.a * (target->alpha > 0 ? target->alpha : 0);
+    return color;
+}
+
+static void targetRect(DrawTarget *target, float x, float y, float width, float height, Color color)
+{
+    color = targetColor(target, color);
+    if (target->image == NULL)
+        DrawRectangle(x, y, width, height, color);
+    else
     {
-        cont = false;
-        Token *context = peekContext(builder);
+        int x0 = x, y0 = y;
+        rasterRect(target, x0, y0, x0 + (int)width, y0 + (int)height, color);
+    }
+}
 
-        switch (context->type)
-        {
-        // Root
-        case TOKEN_ROOT:
-            break;
+static void targetRectLines(DrawTarget *target, Rectangle rec, float thickness, Color color)
+{
+    color = targetColor(target, color);
+    if (target->image == NULL)
+    {
+        DrawRectangleLinesEx(rec, thickness, color);
+        return;
+    }
 
-        // Containers
-        case TOKEN_ROW:
-        {
-            if (token->type == TOKEN_ROW_END)
-            {
-                popContext(builder);
-                token = context;
-                cont = true;
-            }
-            else
-                context->position.x += token->width + context->row.spacing;
-        }
-        break;
-        case TOKEN_COLUMN:
+    // Same edge layout as DrawRectangleLinesEx.
+    if (thickness > rec.width || thickness > rec.height)
+        thickness = (rec.width > rec.height ? rec.height : rec.width) / 2;
+
+    int x0 = roundf(rec.x);
+    int y0 = roundf(rec.y);
+    int x1 = roundf(rec.x + rec.width);
+    int y1 = roundf(rec.y + rec.height);
+    int t0 = roundf(rec.y + thickness);
+    int t1 = roundf(rec.y + rec.height - thickness);
+    int l1 = roundf(rec.x + thickness);
+    int r0 = roundf(rec.x + rec.width - thickness);
+
+    rasterRect(target, x0, y0, x1, t0, color);
+    rasterRect(target, x0, t1, x1, y1, color);
+    rasterRect(target, x0, t0, l1, t1, color);
+    rasterRect(target, r0, t0, x1, t1, color);
+}
+
+static void targetText(DrawTarget *target, const char *text, float x, float y, int fontSize, Color color)
+{
+    color = targetColor(target, color);
+    if (target->image == NULL)
+        drawText(text, x, y, fontSize, color);
+    else
+        rasterText(target, text, x, y, fontSize, color);
+}
+
+static void targetImage(DrawTarget *target, UIAtlasImage image, float x, float y, float width, float height, Color tint)
+{
+    if (image.atlas == NULL)
+        return;
+
+    tint = targetColor(target, tint);
+
+    if (target->image == NULL)
+        DrawTexturePro(atlasTexture(image.atlas, image.page), image.source, (Rectangle){x, y, width, height}, (Vector2){0, 0}, 0, tint);
+    else
+        rasterImage(target, image.atlas->pages[image.page].image, image.source, x, y, width, height, tint);
+}
+
+// Draws the lines of the buffer that fall inside bounds, and the cursor.
+static void targetTextInput(DrawTarget *target, UITextBuffer *buffer, Rectangle bounds, Color color)
+{
+    if (buffer == NULL || bounds.width <= 0 || bounds.height <= 0)
+        return;
+
+    int fontSize = textFontSize(targetFontSize(target, buffer->fontSize));
+    int first = buffer->firstLine;
+    int last = first + (int)ceilf(bounds.height / fontSize);
+    if (last > buffer->numLines)
+        last = buffer->numLines;
+
+    size_t longest = 0;
+    for (int i = first; i < last; i++)
+        if (buffer->lines[i].length > longest)
+            longest = buffer->lines[i].length;
+    char *text = MemAlloc(longest + 1);
+
+    // Lines are drawn shifted left by the scroll and clipped to the bounds,
+    // so only their visible part is rasterized.
+    float x = bounds.x - buffer->scrollX * target->scale;
+    int cursorLine = lineAt(buffer, buffer->cursor);
+
+    DrawTarget clipped = *target;
+    if (target->image == NULL)
+        BeginScissorMode(bounds.x, bounds.y, bounds.width, bounds.height);
+    else
+    {
+        if (clipped.clipX0 < bounds.x)
+            clipped.clipX0 = bounds.x;
+        if (clipped.clipY0 < bounds.y)
+            clipped.clipY0 = bounds.y;
+        if (clipped.clipX1 > bounds.x + bounds.width)
+            clipped.clipX1 = bounds.x + bounds.width;
+        if (clipped.clipY1 > bounds.y + bounds.height)
+            clipped.clipY1 = bounds.y + bounds.height;
+    }
+
+    for (int i = first; i < last; i++)
+    {
+        TextLine *line = &buffer->lines[i];
+        float y = bounds.y + (i - first) * fontSize;
+
+        if (line->width > buffer->scrollX)
         {
-            if (token->type == TOKEN_COLUMN_END)
-            {
-                popContext(builder);
-                token = context;
-                cont = true;
-            }
-            else
-                context->position.y += token->height + context->column.spacing;
+            copyText(buffer, line->start, line->length, text);
+            text[line->length] = '\0';
+            targetText(&clipped, text, x, y, fontSize, color);
         }
-        break;
 
-        // Modifiers
-        default:
+        if (i == cursorLine)
         {
-            popContext(builder);
-            token = context;
-            cont = true;
-        }
-        break;
+            float cursorX = x + buffer->cursorX * target->scale;
+            targetRect(&clipped, cursorX, y, target->scale > 1 ? target->scale : 1, fontSize, color);
         }
-    } while (cont);
+    }
+
+    if (target->image == NULL)
+        EndScissorMode();
+    MemFree(text);
 }
 
-static void draw(UIBuilder *builder, Vector2 position)
+// Combines a transform token with the target, scaling about the center of
+// the transformed element.
+static DrawTarget transformTarget(DrawTarget *target, Token *token)
 {
-    Token *root = peekContext(builder);
-    root->position = position;
+    TransformToken *transform = &token->transform;
+    Vector2 center = {token->position.x + token->width / 2, token->position.y + token->height / 2};
+
+    DrawTarget transformed = *target;
+    transformed.offset.x += (center.x * (1 - transform->scale) + transform->offset.x) * target->scale;
+    transformed.offset.y += (center.y * (1 - transform->scale) + transform->offset.y) * target->scale;
+    transformed.scale *= transform->scale;
+    transformed.alpha *= transform->alpha;
+    return transformed;
+}
 
-    for (size_t i = 0; i < builder->numTokens; i++)
+// Draws the tokens from first up to but not including end.
+static void drawTokens(UIBuilder *builder, DrawTarget *target, size_t first, size_t end)
+{
+    for (size_t i = first; i < end; i++)
     {
         Token *token = &builder->tokenList[i];
         switch (token->type)
         {
-        case TOKEN_ROOT:
-            break;
-
         case TOKEN_RECT:
         {
-            token->position = peekContext(builder)->position;
-            DrawRectangle(token->position.x, token->position.y, token->rect.width, token->rect.height, token->rect.color);
-            updateContextPosition(builder, token);
+            Rectangle bounds = targetBounds(target, token->position, token->rect.width, token->rect.height);
+            Color color = token->rect.color;
+            if (target->overrides != NULL && target->overrides->color.a > 0)
+                color = target->overrides->color;
+            targetRect(target, bounds.x, bounds.y, bounds.width, bounds.height, color);
         }
         break;
 
         case TOKEN_TEXT:
         {
-            token->position = peekContext(builder)->position;
-            DrawText(token->text.text, token->position.x, token->position.y, token->text.fontSize, token->text.color);
-            updateContextPosition(builder, token);
+            // Not culled by its bounds here, since they're only one line high
+            // and don't fit override text. rasterText skips what's outside.
+            Rectangle bounds = targetBounds(target, token->position, token->width, token->height);
+            const char *text = token->text.text;
+            if (target->overrides != NULL && target->overrides->text != NULL)
+                text = target->overrides->text;
+            targetText(target, text, bounds.x, bounds.y, targetFontSize(target, token->text.fontSize), token->text.color);
         }
         break;
 
-        case TOKEN_ROW:
+        case TOKEN_TEXT_INPUT:
         {
-            token->position = peekContext(builder)->position;
-            pushContext(builder, token);
+            Rectangle bounds = targetBounds(target, token->position, token->textInput.width, token->textInput.height);
+            targetTextInput(target, token->textInput.buffer, bounds, token->textInput.color);
         }
         break;
 
-        case TOKEN_ROW_END:
-            updateContextPosition(builder, token);
-            break;
-
-        case TOKEN_COLUMN:
+        case TOKEN_INSTANCE:
         {
-            token->position = peekContext(builder)->position;
-            pushContext(builder, token);
+            size_t index = token->instance.prototype;
+            Token *prototype = &builder->tokenList[index];
+
+            // Skip missing prototypes and instances inside their own prototype.
+            if (index == 0 || (index < i && i <= prototype->last))
+                break;
+
+            DrawTarget stamped = *target;
+            stamped.offset.x += (token->position.x - prototype->position.x) * target->scale;
+            stamped.offset.y += (token->position.y - prototype->position.y) * target->scale;
+            stamped.overrides = &token->instance.overrides;
+            drawTokens(builder, &stamped, index + 1, prototype->last + 1);
         }
         break;
 
-        case TOKEN_COLUMN_END:
+        case TOKEN_PROTOTYPE:
+            i = token->last;
+            break;
+
+        case TOKEN_IMAGE:
         {
-            Token *columnContext = peekContext(builder);
-            popContext(builder);
-            updateContextPosition(builder, columnContext);
+            Rectangle bounds = targetBounds(target, token->position, token->image.width, token->image.height);
+            targetImage(target, token->image.image, bounds.x, bounds.y, bounds.width, bounds.height, token->image.tint);
         }
         break;
 
-        case TOKEN_ALIGN_H:
+        case TOKEN_BORDER:
         {
-            Token *nextToken = &builder->tokenList[i + 1];
-            Token *context = peekContext(builder);
-            token->position = context->position;
-            float width = context->width;
-
-            switch (token->alignH.align)
-            {
-            case LEFT:
-                break;
-            case CENTER:
-                token->position.x += width / 2 - nextToken->width / 2;
-                break;
-            case RIGHT:
-                token->position.x += width - nextToken->width;
-                break;
-            }
-
-            pushContext(builder, token);
+            Rectangle bounds = targetBounds(target, token->position, token->width, token->height);
+            targetRectLines(target, bounds, token->border.thickness * target->scale, token->border.color);
         }
         break;
 
-        case TOKEN_ALIGN_V:
+        case TOKEN_BACKROUND:
         {
-            Token *nextToken = &builder->tokenList[i + 1];
-            Token *context = peekContext(builder);
-            token->position = context->position;
-            float height = context->height;
-
-            switch (token->alignV.align)
-            {
-            case TOP:
-                break;
-            case MIDDLE:
-                token->position.y += height / 2 - nextToken->height / 2;
-                break;
-            case BOTTOM:
-                token->position.y += height - nextToken->height;
-                break;
-            }
-
-            pushContext(builder, token);
+            Rectangle bounds = targetBounds(target, token->position, token->width, token->height);
+            Color color = token->background.color;
+            if (target->overrides != NULL && target->overrides->color.a > 0)
+                color = target->overrides->color;
+            targetRect(target, bounds.x, bounds.y, bounds.width, bounds.height, color);
         }
         break;
 
-        case TOKEN_ALIGN:
+        case TOKEN_PANEL:
         {
-            Token *nextToken = &builder->tokenList[i + 1];
-            Token *context = peekContext(builder);
-            token->position = context->position;
-            float width = context->width;
-            float height = context->height;
-
-            switch (token->align.alignH)
-            {
-            case LEFT:
-                break;
-            case CENTER:
-                token->position.x += width / 2 - nextToken->width / 2;
-                break;
-            case RIGHT:
-                token->position.x += width - nextToken->width;
-                break;
-            }
-
-            switch (token->align.alignV)
-            {
-            case TOP:
-                break;
-            case MIDDLE:
-                token->position.y += height / 2 - nextToken->height / 2;
-                break;
-            case BOTTOM:
-                token->position.y += height - nextToken->height;
-                break;
-            }
-
-            pushContext(builder, token);
+            UIPanelStyle *style = &token->panel.style;
+            Vector2 position = {token->position.x - style->padding, token->position.y - style->padding};
+            Rectangle bounds = targetBounds(target, position, token->width, token->height);
+            if (style->background.a > 0)
+                targetRect(target, bounds.x, bounds.y, bounds.width, bounds.height, style->background);
+            if (style->borderThickness > 0)
+                targetRectLines(target, bounds, style->borderThickness * target->scale, style->borderColor);
         }
         break;
 
-        case TOKEN_PADDING:
+        case TOKEN_TRANSFORM:
         {
-            token->position = peekContext(builder)->position;
-            token->position.x += token->padding.spacing;
-            token->position.y += token->padding.spacing;
-            pushContext(builder, token);
+            DrawTarget transformed = transformTarget(target, token);
+            drawTokens(builder, &transformed, i + 1, token->last + 1);
+            i = token->last;
         }
         break;
 
-        case TOKEN_BORDER:
-        {
-            token->position = peekContext(builder)->position;
-            DrawRectangleLinesEx((Rectangle){token->position.x, token->position.y, token->width, token->height}, token->border.thickness, token->border.color);
-            pushContext(builder, token);
+        default:
+            break;
         }
-        break;
+    }
+}
 
-        case TOKEN_SHIM:
+static void layoutTokens(UIBuilder *builder, Vector2 position)
+{
+    builder->stackIndex = 0;
+    setSizes(builder);
+    setPositions(builder, position);
+    builder->layoutPhase = LAYOUT_DONE;
+}
+
+void UILayout(UIBuilder *builder, Vector2 position)
+{
+    if (builder->captureFile != NULL)
+        captureFrame(builder);
+    layoutTokens(builder, position);
+}
+
+// Lays out the declared UI a few tokens at a time until the budget runs out.
+// Returns true once every token has been sized and positioned.
+bool UILayoutStep(UIBuilder *builder, float budgetMicroseconds)
+{
+    double deadline = GetTime() + budgetMicroseconds / 1e6;
+
+    while (builder->layoutPhase != LAYOUT_DONE)
+    {
+        if (builder->layoutPhase == LAYOUT_SIZES && builder->layoutIndex == 0)
         {
-            token->position = peekContext(builder)->position;
-            pushContext(builder, token);
+            builder->stackIndex = 0;
+            if (builder->captureFile != NULL)
+                captureFrame(builder);
         }
-        break;
 
-        case TOKEN_SHIM_H:
+        size_t end = builder->layoutIndex + LAYOUT_STEP_TOKENS;
+        if (end > builder->numTokens)
+            end = builder->numTokens;
+
+        for (size_t i = builder->layoutIndex; i < end; i++)
         {
-            token->position = peekContext(builder)->position;
-            pushContext(builder, token);
+            if (builder->layoutPhase == LAYOUT_SIZES)
+                sizeToken(builder, i);
+            else
+                positionToken(builder, i);
         }
-        break;
+        builder->layoutIndex = end;
 
-        case TOKEN_SHIM_V:
+        if (builder->layoutIndex == builder->numTokens)
         {
-            token->position = peekContext(builder)->position;
-            pushContext(builder, token);
+            if (builder->stackIndex > 0)
+                TraceLog(LOG_INFO, "UIBuilder: Context stack not empty.");
+
+            if (builder->layoutPhase == LAYOUT_SIZES)
+            {
+                builder->layoutPhase = LAYOUT_POSITIONS;
+                builder->layoutIndex = 0;
+                peekContext(builder)->position = (Vector2){0, 0};
+            }
+            else
+                builder->layoutPhase = LAYOUT_DONE;
         }
-        break;
 
-        case TOKEN_BACKROUND:
+        if (GetTime() >= deadline)
+            break;
+    }
+
+    return builder->layoutPhase == LAYOUT_DONE;
+}
+
+void UIDraw(UIBuilder *builder, Vector2 position)
+{
+    UILayout(builder, position);
+
+    DrawTarget target = {.scale = 1, .alpha = 1};
+    drawTokens(builder, &target, 0, builder->numTokens);
+}
+
+// Draws a UI laid out with UILayoutStep. Draws nothing until it's done.
+void UIDrawLayout(UIBuilder *builder, Vector2 position)
+{
+    if (builder->layoutPhase != LAYOUT_DONE)
+        return;
+
+    DrawTarget target = {.offset = position, .scale = 1, .alpha = 1};
+    drawTokens(builder, &target, 0, builder->numTokens);
+}
+
+// Draws the UI laid out at its declared size, scaled about the origin.
+// Layout only runs when something that affects it has changed since the
+// last call, so changing only the scale or position is cheap.
+void UIDrawScaled(UIBuilder *builder, Vector2 position, float scale)
+{
+    // Captured even when the layout comes from the cache.
+    if (builder->captureFile != NULL)
+        captureFrame(builder);
+
+    unsigned long long hash = layoutHash(builder);
+
+    if (builder->layoutCache != NULL && builder->layoutCacheSize == builder->numTokens && builder->layoutHash == hash)
+    {
+        for (size_t i = 0; i < builder->numTokens; i++)
         {
-            token->position = peekContext(builder)->position;
-            DrawRectangle(token->position.x, token->position.y, token->width, token->height, token->background.color);
-            pushContext(builder, token);
+            TokenLayout *layout = &builder->layoutCache[i];
+            Token *token = &builder->tokenList[i];
+            token->width = layout->width;
+            token->height = layout->height;
+            token->position = layout->position;
+            token->last = layout->last;
         }
-        break;
+        builder->layoutPhase = LAYOUT_DONE;
+    }
+    else
+    {
+        layoutTokens(builder, (Vector2){0, 0});
+
+        if (builder->layoutCache == NULL)
+            builder->layoutCache = MemAlloc(sizeof(TokenLayout) * builder->maxTokens);
+        for (size_t i = 0; i < builder->numTokens; i++)
+        {
+            Token *token = &builder->tokenList[i];
+            builder->layoutCache[i] = (TokenLayout){token->width, token->height, token->position, token->last};
         }
+        builder->layoutCacheSize = builder->numTokens;
+        builder->layoutHash = hash;
     }
+
+    DrawTarget target = {.offset = position, .scale = scale, .alpha = 1};
+    drawTokens(builder, &target, 0, builder->numTokens);
 }
 
-void UIDraw(UIBuilder *builder, Vector2 position)
+void UIRasterize(UIBuilder *builder, Image *image, Vector2 position)
 {
-    setSizes(builder);
-    draw(builder, position);
+    UILayout(builder, position);
+    UIRasterizeTile(builder, image, (Rectangle){0, 0, image->width, image->height});
+}
+
+void UIRasterizeTile(UIBuilder *builder, Image *image, Rectangle tile)
+{
+    if (image->format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8)
+    {
+        TraceLog(LOG_INFO, "UIBuilder: Rasterize target must be R8G8B8A8.");
+        return;
+    }
+
+    DrawTarget target = {
+        .scale = 1,
+        .alpha = 1,
+        .image = image,
+        .clipX0 = tile.x < 0 ? 0 : tile.x,
+        .clipY0 = tile.y < 0 ? 0 : tile.y,
+        .clipX1 = tile.x + tile.width > image->width ? image->width : tile.x + tile.width,
+        .clipY1 = tile.y + tile.height > image->height ? image->height : tile.y + tile.height,
+    };
+    drawTokens(builder, &target, 0, builder->numTokens);
 }
 #pragma endregion
\ No newline at end of file
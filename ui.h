@@ -19,11 +19,67 @@ typedef enum AlignV
 } AlignV;
 
 typedef struct UIBuilder UIBuilder;
+typedef struct UIReplay UIReplay;
+typedef struct UIAtlas UIAtlas;
+typedef struct UITextBuffer UITextBuffer;
+
+// An image packed into a UIAtlas page.
+typedef struct UIAtlasImage
+{
+    UIAtlas *atlas;
+    int page;
+    Rectangle source;
+} UIAtlasImage;
+
+// A chain of modifiers in one element. The zero value of each field
+// leaves that modifier out.
+typedef struct UIPanelStyle
+{
+    AlignH alignH;
+    AlignV alignV;
+    Color background;
+    float borderThickness;
+    Color borderColor;
+    float padding;
+} UIPanelStyle;
+
+// Fields of a prototype to replace in one instance of it. A zeroed field
+// keeps the prototype's value.
+typedef struct UIInstanceOverrides
+{
+    const char *text; // Replaces the text of every UIText
+    Color color;      // Replaces the color of every UIRect and UIBackground
+} UIInstanceOverrides;
+
+typedef struct UIAtlasStats
+{
+    int pages;
+    int images;
+    long usedPixels;
+    long totalPixels;
+    float occupancy;
+} UIAtlasStats;
 
 UIBuilder *UIBuilderAlloc(size_t maxTokens);
 
 void UIBuilderFree(UIBuilder *builder);
 
+bool UILoadFont(const char *fileName, int fontSize);
+void UIUnloadFont(void);
+
+UIAtlas *UIAtlasAlloc(int pageWidth, int pageHeight);
+void UIAtlasFree(UIAtlas *atlas);
+UIAtlasImage UIAtlasAdd(UIAtlas *atlas, Image image);
+UIAtlasStats UIAtlasGetStats(UIAtlas *atlas);
+
+UITextBuffer *UITextBufferAlloc(const char *text, int fontSize);
+void UITextBufferFree(UITextBuffer *buffer);
+size_t UITextBufferLength(UITextBuffer *buffer);
+void UITextBufferGetText(UITextBuffer *buffer, char *text);
+void UITextBufferInsert(UITextBuffer *buffer, size_t position, const char *text);
+void UITextBufferDelete(UITextBuffer *buffer, size_t position, size_t length);
+void UITextBufferUpdate(UITextBuffer *buffer);
+
 void UIInit(UIBuilder *builder);
 void UIInitEx(UIBuilder *builder, float width, float height);
 
@@ -31,6 +87,10 @@ void UIRect(UIBuilder *builder, float width, float height, Color color);
 
 void UIText(UIBuilder *builder, const char *text, int fontSize, Color color);
 
+void UIImage(UIBuilder *builder, UIAtlasImage image, float width, float height, Color tint);
+
+void UITextInput(UIBuilder *builder, UITextBuffer *buffer, float width, float height, Color color);
+
 void UIRow(UIBuilder *builder, float spacing);
 void UIRowEnd(UIBuilder *builder);
 
@@ -51,6 +111,30 @@ void UIShimV(UIBuilder *builder, float height);
 
 void UIBackground(UIBuilder *builder, Color color);
 
+void UIPanel(UIBuilder *builder, UIPanelStyle style);
+
+void UITransform(UIBuilder *builder, Vector2 offset, float scale, float alpha);
+
+void UIPrototype(UIBuilder *builder, int prototypeId);
+void UIInstance(UIBuilder *builder, int prototypeId, UIInstanceOverrides overrides);
+
+void UILayout(UIBuilder *builder, Vector2 position);
 void UIDraw(UIBuilder *builder, Vector2 position);
 
+bool UILayoutStep(UIBuilder *builder, float budgetMicroseconds);
+void UIDrawLayout(UIBuilder *builder, Vector2 position);
+
+void UIDrawScaled(UIBuilder *builder, Vector2 position, float scale);
+
+void UIRasterize(UIBuilder *builder, Image *image, Vector2 position);
+void UIRasterizeTile(UIBuilder *builder, Image *image, Rectangle tile);
+
+bool UICaptureBegin(UIBuilder *builder, const char *fileName);
+void UICaptureEnd(UIBuilder *builder);
+
+UIReplay *UIReplayOpen(const char *fileName);
+void UIReplayClose(UIReplay *replay);
+bool UIReplayNextFrame(UIReplay *replay, UIBuilder *builder);
+bool UIReplayFrameHasText(UIReplay *replay);
+
 #endif
\ No newline at end of file